@@ -0,0 +1,164 @@
+#!/usr/bin/env python
+"""Scaling benchmark for seamc (CPU) and seamcl (OpenCL).
+
+Sweeps every image over a list of seam counts, runs each tool --repeat times
+with --stats=json and reports the median and p95 wall time plus ns per pixel
+per seam for every stage.  Results go to a CSV with the andromeda.csv columns
+first (so old and new runs can sit in one sheet), then the extra columns.
+
+    ./bench.py --seamc=../seamc/seamc --seamcl=../seamcl/src/seamcl castle-*.tif
+
+A seam count is a number of columns or 'half' (half the width, as in the old
+run.sh).  Leave --seamc or --seamcl empty to skip that tool.
+"""
+
+from __future__ import print_function
+
+import argparse
+import csv
+import json
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+
+ANDROMEDA = ['input_image', 'cols_removed',
+             'seamcl_total_time_seconds', 'seamcl_avg_time_per_iteration_milliseconds',
+             'seamc_total_time_seconds', 'seamc_total_time_milliseconds',
+             'seamc_avg_time_per_iteration_milliseconds',
+             'orig_width', 'actual_half_c', 'act_100_c', 'avg_ns_row_c']
+
+TOOLS = ('seamc', 'seamcl')
+
+
+def image_size(path):
+    out = subprocess.check_output(['identify', '-format', '%w %h\n', path])
+    w, h = out.decode().split('\n')[0].split()
+    return int(w), int(h)
+
+
+def seam_counts(spec, width):
+    counts = []
+    for s in spec.split(','):
+        n = width // 2 if s == 'half' else int(s)
+        if 0 < n < width and n not in counts:
+            counts.append(n)
+    return counts
+
+
+def percentile(values, pct):
+    """Nearest rank, same as the --stats p50/p95."""
+    v = sorted(values)
+    rank = int(pct / 100.0 * len(v) + 0.5)
+    return v[min(max(rank - 1, 0), len(v) - 1)]
+
+
+def run_once(tool, exe, flags, image, seams, tmp):
+    stats = os.path.join(tmp, tool + '.json')
+    out = os.path.join(tmp, 'out' + os.path.splitext(image)[1])
+    if tool == 'seamc':
+        cmd = [exe] + flags + ['--stats=json', '--stats-out=' + stats, image, out, str(-seams)]
+    else:
+        cmd = [exe] + flags + ['--stats=json', '--stats-out=' + stats, image, out, str(seams)]
+    with open(os.devnull, 'w') as null:
+        subprocess.check_call(cmd, stdout=null)
+    with open(stats) as f:
+        return json.load(f)
+
+
+def bench(tool, exe, flags, image, seams, repeat, tmp):
+    runs = [run_once(tool, exe, flags, image, seams, tmp) for _ in range(repeat)]
+    total = [r[tool + '_total_time_seconds'] for r in runs]
+    res = {'median': percentile(total, 50), 'p95': percentile(total, 95), 'stages': {}}
+    for stage in runs[0]['stages']:
+        res['stages'][stage] = percentile([r['stages'][stage]['total_ms'] for r in runs], 50)
+    if 'act_100_c' in runs[0]:
+        res['act_100'] = percentile([r['act_100_c'] for r in runs], 50)
+    return res
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    ap.add_argument('images', nargs='+')
+    ap.add_argument('--seamc', default='../seamc/seamc')
+    ap.add_argument('--seamcl', default='../seamcl/src/seamcl')
+    ap.add_argument('--seamc-flags', default='', help='extra seamc options, e.g. "--lean"')
+    ap.add_argument('--seamcl-flags', default='', help='extra seamcl options')
+    ap.add_argument('--seams', default='10,100,half')
+    ap.add_argument('--repeat', type=int, default=5)
+    ap.add_argument('--out', default='bench.csv')
+    args = ap.parse_args()
+
+    exes = {'seamc': args.seamc, 'seamcl': args.seamcl}
+    flags = {'seamc': args.seamc_flags.split(), 'seamcl': args.seamcl_flags.split()}
+    tools = [t for t in TOOLS if exes[t]]
+    for t in tools:
+        exes[t] = os.path.abspath(exes[t])
+        if not os.access(exes[t], os.X_OK):
+            sys.exit('%s not found at %s (build it or pass --%s=)' % (t, exes[t], t))
+
+    # Smallest first, so the crossover reads top to bottom
+    images = sorted((image_size(i), os.path.abspath(i)) for i in args.images)
+    tmp = tempfile.mkdtemp(prefix='seambench')
+    rows, stages = [], dict((t, []) for t in tools)
+    try:
+        for (width, height), image in images:
+            for seams in seam_counts(args.seams, width):
+                print('%s %dx%d, %d seams:' % (os.path.basename(image), width, height, seams),
+                      end='')
+                # Pixels visited summed over every seam (the image narrows by one each time)
+                pixel_seams = height * seams * (width - (seams - 1) / 2.0)
+                row = {'input_image': os.path.basename(image), 'cols_removed': seams,
+                       'orig_width': width, 'height': height, 'repeats': args.repeat}
+                for t in tools:
+                    res = bench(t, exes[t], flags[t], image, seams, args.repeat, tmp)
+                    print(' %s %.3fs' % (t, res['median']), end='')
+                    sys.stdout.flush()
+                    row[t + '_total_time_seconds'] = res['median']
+                    row[t + '_avg_time_per_iteration_milliseconds'] = res['median'] * 1e3 / seams
+                    row[t + '_p95_seconds'] = res['p95']
+                    for stage, ms in res['stages'].items():
+                        if stage not in stages[t]:
+                            stages[t].append(stage)
+                        row['%s_%s_ns_px_seam' % (t, stage)] = ms * 1e6 / pixel_seams
+                    if t == 'seamc':
+                        row['seamc_total_time_milliseconds'] = res['median'] * 1e3
+                        row['act_100_c'] = res['act_100']
+                        row['avg_ns_row_c'] = res['median'] * 1e6 / seams / width
+                        if abs(2 * seams - width) <= 1:
+                            row['actual_half_c'] = res['median']
+                print()
+                rows.append(row)
+    finally:
+        shutil.rmtree(tmp)
+
+    extra = ['height', 'repeats'] + ['%s_p95_seconds' % t for t in tools]
+    for t in tools:
+        extra += ['%s_%s_ns_px_seam' % (t, s) for s in stages[t]]
+    with open(args.out, 'w') as f:
+        w = csv.DictWriter(f, ANDROMEDA + extra, restval='', lineterminator='\n')
+        w.writeheader()
+        for r in rows:
+            w.writerow(dict((k, '%.6f' % v if isinstance(v, float) else v) for k, v in r.items()))
+    print('Wrote %d rows to %s' % (len(rows), args.out))
+
+    if len(tools) == 2:
+        # First (smallest) image where the GPU wins, per seam count spec
+        crossover = {}
+        for r in rows:
+            key = 'half' if abs(2 * r['cols_removed'] - r['orig_width']) <= 1 else r['cols_removed']
+            if key not in crossover and r['seamcl_total_time_seconds'] < r['seamc_total_time_seconds']:
+                crossover[key] = r
+        for spec in args.seams.split(','):
+            key = spec if spec == 'half' else int(spec)
+            r = crossover.get(key)
+            if r:
+                print('%s seams: seamcl faster from %s (%dx%d)'
+                      % (spec, r['input_image'], r['orig_width'], r['height']))
+            else:
+                print('%s seams: seamc faster at every size' % spec)
+
+
+if __name__ == '__main__':
+    main()
@@ -1,10 +0,0 @@
-time ~/seamc castle-10.tif OUT-castle-10.tif -71
-time ~/seamc castle-20.tif OUT-castle-20.tif -143
-time ~/seamc castle-30.tif OUT-castle-30.tif -214
-time ~/seamc castle-40.tif OUT-castle-40.tif -285
-time ~/seamc castle-50.tif OUT-castle-50.tif -357
-time ~/seamc castle-60.tif OUT-castle-60.tif -428
-time ~/seamc castle-70.tif OUT-castle-70.tif -500
-time ~/seamc castle-80.tif OUT-castle-80.tif -571
-time ~/seamc castle-90.tif OUT-castle-90.tif -642
-time ~/seamc castle-100.ti OUT-castle-100.ti -714
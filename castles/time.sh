@@ -1,8 +0,0 @@
-echo "time ~/seamc castle-20.tif OUT-castle-20.tif -143"
-time ~/seamc castle-20.tif OUT-castle-20.tif -143
-echo "time ~/seamc castle-40.tif OUT-castle-40.tif -285"
-time ~/seamc castle-40.tif OUT-castle-40.tif -285
-echo "time ~/seamc castle-60.tif OUT-castle-60.tif -428"
-time ~/seamc castle-60.tif OUT-castle-60.tif -428
-echo "time ~/seamc castle-80.tif OUT-castle-80.tif -571"
-time ~/seamc castle-80.tif OUT-castle-80.tif -571
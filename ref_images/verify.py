@@ -0,0 +1,146 @@
+#!/usr/bin/env python
+"""Seam-exact differential check of seamc and seamcl.
+
+For every reference image (ORIG/<img> with carves in <img>_py<N>/) this runs
+  seamc_grey   against the carve.py carves (seamc_grey is the port of carve.py)
+  seamc        against seamcl, colour, seam for seam
+with --dump-seams and reports the first iteration and row where they diverge.
+
+seamc and seamcl only agree bit for bit with integer energies (float sums can
+round differently on the device and break a tie the other way), so both run
+with --precision=int unless --seamc-flags/--seamcl-flags say otherwise.
+
+carve.py only backtracks rows 2 .. height-6 (the rest of its carves lines are
+left over from the previous seam), so only those rows are compared with it.
+
+--fast carves just the first --fast-seams seams of each image, which is cheap
+enough to run before every benchmark sweep.  Exit status is 1 if anything
+diverged.
+"""
+
+from __future__ import print_function
+
+import argparse
+import glob
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CARVES_LINE = re.compile(r'(\d+) x (\d+):((?: -?\d+)*)')
+
+
+def read_carves(path):
+    """List of (height, width, [x per row]), one per seam."""
+    seams = []
+    with open(path) as f:
+        for line in f:
+            m = CARVES_LINE.match(line.strip())
+            if m:
+                seams.append((int(m.group(1)), int(m.group(2)),
+                              [int(x) for x in m.group(3).split()]))
+    return seams
+
+
+def reference(name):
+    """Longest carves file for an image."""
+    best = []
+    for path in glob.glob(os.path.join(HERE, name + '_py*', 'carves')):
+        seams = read_carves(path)
+        if len(seams) > len(best):
+            best = seams
+    return best
+
+
+def first_divergence(expected, actual, rows=None):
+    """(iteration, row, expected x, actual x) of the first difference, or None.
+    A missing seam counts as diverging at row -1."""
+    for i, (e, a) in enumerate(zip(expected, actual)):
+        lo, hi = rows(e[0]) if rows else (0, e[0])
+        if e[1] != a[1]:
+            return i, -1, e[1], a[1]
+        for y in range(lo, min(hi, len(e[2]), len(a[2]))):
+            if e[2][y] != a[2][y]:
+                return i, y, e[2][y], a[2][y]
+    if len(actual) < len(expected):
+        return len(actual), -1, None, None
+    return None
+
+
+def carve(cmd, argv0, image, seams, tmp):
+    log = os.path.join(tmp, argv0 + '.carves')
+    out = os.path.join(tmp, 'out' + os.path.splitext(image)[1])
+    with open(os.devnull, 'w') as null:
+        ret = subprocess.call([argv0] + cmd[1:] + ['--dump-seams=' + log, image, out, seams],
+                              executable=cmd[0], stdout=null, stderr=null)
+    if ret != 0 or not os.path.exists(log):
+        print('  %s failed (exit %d)' % (argv0, ret))
+        return []
+    return read_carves(log)
+
+
+def report(what, div, n):
+    if div is None:
+        print('  %-26s %d seams match' % (what, n))
+        return True
+    i, y, e, a = div
+    if y < 0:
+        print('  %-26s iteration %d: seam missing or width differs' % (what, i))
+    else:
+        print('  %-26s first diverges at iteration %d, row %d (x %d vs %d)' % (what, i, y, e, a))
+    return False
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    ap.add_argument('images', nargs='*', help='names in ORIG/ (default: all with carves)')
+    ap.add_argument('--seamc', default=os.path.join(HERE, '../seamc/seamc'))
+    ap.add_argument('--seamcl', default=os.path.join(HERE, '../seamcl/src/seamcl'))
+    ap.add_argument('--seamc-flags', default='--precision=int')
+    ap.add_argument('--seamcl-flags', default='--precision=int')
+    ap.add_argument('--fast', action='store_true', help='only carve the first few seams')
+    ap.add_argument('--fast-seams', type=int, default=4, metavar='N')
+    args = ap.parse_args()
+
+    seamc = os.path.abspath(args.seamc) if args.seamc else None
+    seamcl = os.path.abspath(args.seamcl) if args.seamcl else None
+    for exe in (seamc, seamcl):
+        if exe and not os.access(exe, os.X_OK):
+            sys.exit('%s not found (build it, or pass an empty path to skip it)' % exe)
+
+    names = args.images or sorted(set(os.path.basename(d).rsplit('_py', 1)[0]
+                                      for d in glob.glob(os.path.join(HERE, '*_py*'))))
+    tmp = tempfile.mkdtemp(prefix='seamverify')
+    ok = True
+    try:
+        for name in names:
+            ref = reference(name)
+            image = os.path.join(HERE, 'ORIG', name)
+            if not ref or not os.path.exists(image):
+                print('%s: no reference carves or no ORIG image, skipped' % name)
+                continue
+            if args.fast:
+                ref = ref[:args.fast_seams]
+            n = str(len(ref))
+            print('%s (%d x %d, %s seams)' % (name, ref[0][1], ref[0][0], n))
+
+            cpu = None
+            if seamc:
+                grey = carve([seamc], 'seamc_grey', image, '-' + n, tmp)
+                ok &= report('seamc_grey vs carve.py',
+                             first_divergence(ref, grey, lambda h: (2, h - 5)), len(ref))
+                cpu = carve([seamc] + args.seamc_flags.split(), 'seamc', image, '-' + n, tmp)
+            if seamcl:
+                gpu = carve([seamcl] + args.seamcl_flags.split(), 'seamcl', image, n, tmp)
+                if cpu is not None:
+                    ok &= report('seamcl vs seamc', first_divergence(cpu, gpu), len(cpu))
+    finally:
+        shutil.rmtree(tmp)
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
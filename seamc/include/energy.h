@@ -12,11 +12,22 @@
 void SEAMC_glaplauxian( //
         float** resultMatrix, const F4_t **srcImg, //
         const int width, const int height);
+/*
+ ** from{Row} is inclusive, to{Row} is non-inclusive.  Only the result rows
+ **   in range are written, and only source rows within one of the range
+ **   (clipped to the image) are read, so strips can be done independently.
+ */
 void SEAMC_gaussian( //
         F4_t** resultImage, const F4_t **srcImg, //
-        const int width, const int height);
+        const int width, const int height, const int fromRow, const int toRow);
 void SEAMC_gradient( //
         float** resultMatrix, const F4_t **srcImg, //
-        const int width, const int height);
+        const int width, const int height, const int fromRow, const int toRow);
+/* Integer Sobel of integer luminance, the energy seamcl computes with
+ **   --precision=int.  Rows as SEAMC_gaussian.
+ */
+void SEAMC_sobelInt( //
+        uint16_t** resultMatrix, const F4_t **srcImg, //
+        const int width, const int height, const int fromRow, const int toRow);
 
 #endif // _ENERGY_H_
@@ -0,0 +1,31 @@
+#ifndef _FIXED_H_
+#define _FIXED_H_
+
+#include <stdint.h>
+
+/* Reduced precision DP.  The DP only needs the ordering of path costs, so
+ **   gradients are quantized to uint16 and costs summed in uint32.  That is
+ **   6 bytes per pixel through the DP instead of 8.
+ **
+ ** The gradient tops out around 1704 (sqrt(2) * 1024 + 256), so a scale of
+ **   32 keeps it under 65535 with 5 fractional bits.  A uint32 cost then
+ **   can't overflow for images under ~78000 rows; past that sums saturate
+ **   at SEAMC_COST_SAT and the saturated cells are counted.
+ */
+
+#define SEAMC_FIXED_SCALE 32.0f
+#define SEAMC_COST_SAT UINT32_MAX
+
+enum SEAMC_PRECISION {
+    SEAMC_FLOAT = 0,    // 32 bit float gradient and cost
+    SEAMC_FIXED,        // uint16 gradient, uint32 saturating cost
+    SEAMC_COMPARE,      // Carve with float, count seams where fixed would differ
+    SEAMC_INTEGER       // seamcl's energy (integer Sobel of integer luma) and uint32 cost,
+                        //   gives the same seams as seamcl --precision=int bit for bit
+};
+
+void SEAMC_quantizeRows(uint16_t **Q, float **G, int width, int fromRow, int toRow);
+long SEAMC_dpFixed(uint32_t **Y, uint16_t **Q, int width, int height);
+void SEAMC_backtrackFixed(int *O, uint32_t **Y, int width, int height);
+
+#endif // _FIXED_H_
@@ -2,6 +2,9 @@
 #define _MAGIC_H_
 
 #include "numcy.h"
+#include "ooc.h"
+#include "fixed.h"
+#include "stats.h"
 
 #include <wand/MagickWand.h>
 
@@ -10,7 +13,10 @@ MagickWand* MW_FromMatrix(void** M, int H, int W, bool isCOLOR = true);
 void** MW_ToMatrix(MagickWand *mw_in, int *pH, int *pW, bool isCOLOR = true);
 
 MagickWand* MW_Carve(const MagickWand *mw_in, int newH, int newW, bool isCOLOR = true,
-        bool drawLINE = false);
+        bool drawLINE = false, bool leanDP = false, int precision = SEAMC_FLOAT,
+        SEAMC_STATS_t *stats = NULL);
+MagickWand* MW_CarveOOC(MagickWand *mw_in, int newH, int newW, const SEAMC_OOC_t *ooc,
+        bool drawLINE = false, SEAMC_STATS_t *stats = NULL);
 
 void MW_DumpMatrix(void** M, int H, int W, const char*fileName, bool isCOLOR = true);
 
@@ -159,6 +159,23 @@ inline void* np_free_array_x(void* A)
 void** np_new_matrix_x(size_t height, size_t width, size_t *pPitch, size_t sz, bool doZero = false);
 void** np_free_matrix_x(void** M);
 
+/* File-backed matrix for images that do not fit in RAM.  Same array of rows
+ **   layout as np_new_matrix_x, but the backing array is an mmap'd file so
+ **   the kernel can page rows in and out.  Callers walking the matrix in
+ **   strips should np_release_rows() what they are done with to keep the
+ **   resident set bounded.
+ */
+struct NP_MAP_t {
+    void **rows;
+    char *base;
+    size_t bytes, rowBytes;
+    int fd;
+};
+
+NP_MAP_t* np_map_matrix_x(const char *path, size_t height, size_t width, size_t sz);
+NP_MAP_t* np_unmap_matrix_x(NP_MAP_t *MAP);
+void np_release_rows(NP_MAP_t *MAP, size_t fromRow, size_t toRow);
+
 template<class T>
 inline T* np_new_array(size_t LEN)
 {
@@ -0,0 +1,22 @@
+#ifndef _OOC_H_
+#define _OOC_H_
+
+#include "numcy.h"
+#include "stats.h"
+
+#include <stddef.h>
+
+/* Out-of-core carving.  The image lives in a file-backed NP_MAP_t and energy,
+ **   DP and backtrack stream through it in horizontal strips, so the working
+ **   set is bounded by budgetBytes rather than by the size of the image.
+ */
+typedef struct SEAMC_OOC {
+    size_t budgetBytes; // Peak for the strip buffers (also caps ImageMagick's pixel cache)
+    const char *swapPath; // Backing file for the image, NULL for an unlinked temp file
+} SEAMC_OOC_t;
+
+int SEAMC_stripRows(int width, int height, size_t budgetBytes);
+void SEAMC_carveStrips(NP_MAP_t *IMG, int inW, int inH, int newW, size_t budgetBytes,
+        bool drawLINE = false, SEAMC_STATS_t *stats = NULL);
+
+#endif // _OOC_H_
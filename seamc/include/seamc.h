@@ -2,6 +2,8 @@
 #define _SEAMC_H_
 
 #include "numcy.h"
+#include "fixed.h"
+#include "stats.h"
 
 #include <float.h>
 #include <math.h>
@@ -11,22 +13,56 @@
  **   later when translating to various parallel/distributed versions.
  */
 typedef struct SEAMC_WORK {
-    time_t start_time, finish_time; // Epoch time
-    clock_t start_clock, finish_clock; // CPU execution time (might break when using threads & GPU???)
-            
+    SEAMC_TICK_t start_tick, stage_tick; // Iteration start, and start of the current stage
+    
     int height, width, xdim, ydim;
     /* Could consider having matrices here too ?? */
 } SEAMC_WORK_t, *SEAMC_WORK_p;
 
+/* Checkpointed cost matrix for memory-lean DP.  Instead of the full matrix
+ **   only the cost row above each k-row segment is kept (CKPT[s] is row
+ **   s * k - 1, CKPT[0] is unused), plus k rows of scratch for whichever
+ **   segment is being worked on.  Y is a full-height row table so the regular
+ **   DP/backtrack functions can be pointed at a segment with image rows.
+ */
+typedef struct SEAMC_CKPT {
+    int height, pitch, k, numSegs;
+    float **CKPT;
+    float **Y;
+    float *store;
+} SEAMC_CKPT_t, *SEAMC_CKPT_p;
+
+/* The one tie rule every backend follows, so seams can be compared for
+ **   equality: the bottom row takes the leftmost minimum, then each step up
+ **   takes the centre if it is no worse than either side, else the left if
+ **   it is no worse than the right, else the right.  Pass the type's max for
+ **   a neighbour off the edge.  seamcl's SEAM_STEP is the same rule.
+ */
+template<typename T>
+static inline int SEAMC_seamStep(T L, T C, T R)
+{
+    return ((C <= L) && (C <= R)) ? 0 : (L <= R) ? -1 : 1;
+}
+
 /* Core function headers for seam carving */
 
-void SEAMC_dp(float **Y, float **G, short width, int height);
-void SEAMC_backtrack(int *O, float **Y, short width, int height);
+void SEAMC_dp(float **Y, float **G, int width, int height);
+void SEAMC_dpRows(float **Y, float **G, int width, int fromRow, int toRow);
+void SEAMC_backtrack(int *O, float **Y, int width, int height);
+int SEAMC_backtrackRows(int *O, float **Y, int width, int fromRow, int toRow, int idx);
+int SEAMC_argminRow(const float *pY, int width);
+
+SEAMC_CKPT_t* SEAMC_newCheckpoints(int width, int height, int k = 0);
+SEAMC_CKPT_t* SEAMC_freeCheckpoints(SEAMC_CKPT_t *CK);
+void SEAMC_ckptSegment(SEAMC_CKPT_t *CK, int s, int width, bool save, int *pFrom, int *pTo);
+void SEAMC_dpCheckpoint(SEAMC_CKPT_t *CK, float **G, int width);
+void SEAMC_backtrackCheckpoint(int *O, SEAMC_CKPT_t *CK, float **G, int width);
 void SEAMC_carveKernel(void **DST, void **SRC, int width, int height, int32_t *CARVE, int pixBytes);
 void SEAMC_lineKernel(void **DST, void **SRC, int width, int height, int32_t *CARVE, int pixBytes);
-void SEAMC_zeroKernel(void **Y, short width, int height, int pixBytes);
+void SEAMC_zeroKernel(void **Y, int width, int height, int pixBytes);
 
 void** SEAMC_carve(void **iM, int iW, int iH, int newW, int newH, bool isCOLOR = true,
-        bool drawLINE = false);
+        bool drawLINE = false, bool leanDP = false, int precision = SEAMC_FLOAT,
+        SEAMC_STATS_t *stats = NULL);
 
 #endif // _SEAMC_H_
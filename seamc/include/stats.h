@@ -0,0 +1,58 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <chrono>
+
+/* Per-stage timing.  Every stage is bracketed with steady_clock, the totals
+ **   accumulate per stage and each call also lands in a log2(ns) histogram,
+ **   so a few slow calls stand out from the steady state.
+ **
+ ** Output uses the andromeda.csv columns (seamcl_* left empty, this is the
+ **   CPU side) followed by per-stage totals, so CPU and GPU runs line up:
+ **   actual_half_c   total seconds, only when cols_removed is half the width
+ **   act_100_c       seconds for the first 100 seams
+ **   avg_ns_row_c    avg ms per seam * 1000 / orig_width, as in the sheet
+ */
+
+enum SEAMC_STAGE {
+    SEAMC_ENERGY = 0,
+    SEAMC_DP,
+    SEAMC_BACKTRACK,
+    SEAMC_CARVE,
+    SEAMC_ZERO,
+    SEAMC_IO,           // MagickWand <-> matrix conversion
+    SEAMC_NUM_STAGES
+};
+
+#define SEAMC_HIST_BINS 40  // 2^40 ns is about 18 minutes
+
+typedef std::chrono::steady_clock::time_point SEAMC_TICK_t;
+
+typedef struct SEAMC_STATS {
+    const char *inputImage;
+    int origWidth, height;
+    int numSeams, maxSeams; // Seams carved so far, room in iterNs
+    double *iterNs;         // Wall time of each seam
+    double totalNs;
+    double stageNs[SEAMC_NUM_STAGES];
+    long stageCalls[SEAMC_NUM_STAGES];
+    long stageHist[SEAMC_NUM_STAGES][SEAMC_HIST_BINS];
+    FILE *seamLog;          // If set, every seam in the carve.py "carves" format
+} SEAMC_STATS_t;
+
+SEAMC_STATS_t* SEAMC_newStats(const char *inputImage, int origWidth, int height, int maxSeams);
+SEAMC_STATS_t* SEAMC_freeStats(SEAMC_STATS_t *S);
+
+inline SEAMC_TICK_t SEAMC_tick()
+{
+    return std::chrono::steady_clock::now();
+}
+double SEAMC_tock(SEAMC_STATS_t *S, int stage, SEAMC_TICK_t &tick);
+double SEAMC_statsIteration(SEAMC_STATS_t *S, SEAMC_TICK_t start);
+
+void SEAMC_writeStats(FILE *out, const SEAMC_STATS_t *S, bool asJSON);
+void SEAMC_logSeam(SEAMC_STATS_t *S, const int32_t *CARVE, int width, int height);
+
+#endif // _STATS_H_
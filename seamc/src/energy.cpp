@@ -9,6 +9,9 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <algorithm>
+
+using namespace std;
 
 #define _PI_ 3.14159265
 
@@ -60,7 +63,7 @@ void SEAMC_glaplauxian( //
 
 void SEAMC_gaussian( //
         F4_t** resultImage, const F4_t **srcImg, //
-        const int width, const int height)
+        const int width, const int height, const int fromRow, const int toRow)
 {
     static const float X = 1.0f / 16.0f;
     static const
@@ -70,7 +73,7 @@ void SEAMC_gaussian( //
             1.0f * X, 2.0f * X, 1.0f * X };
     
     const IMG4_t SRC(srcImg, width, height);
-    for (int y = 0; y < height; y++) {
+    for (int y = fromRow; y < toRow; y++) {
         F4_t *pResultRow = resultImage[y];
         for (int x = 0; x < width; x++) {
             
@@ -93,7 +96,7 @@ void SEAMC_gaussian( //
 
 void SEAMC_gradient( //
         float** resultMatrix, const F4_t **srcImg, //
-        const int width, const int height)
+        const int width, const int height, const int fromRow, const int toRow)
 {
     static const float X = 1.0f;
     static const F4_t luma_coef( //
@@ -101,7 +104,7 @@ void SEAMC_gradient( //
                     );
     
     const IMG4_t SRC(srcImg, width, height);
-    for (int y = 0; y < height; y++) {
+    for (int y = fromRow; y < toRow; y++) {
         float *pResultRow = resultMatrix[y];
         for (int x = 0; x < width; x++) {
             // Determine what portion of image to operate on:
@@ -126,3 +129,44 @@ void SEAMC_gradient( //
         }
     }
 }
+
+/* Rec. 601 luma in 8 bit fixed point (77 + 150 + 29 = 256) from 8 bit
+ ** channels, exactly as LUM() in seamcl's integer prelude.
+ */
+static inline int lumInt(const F4_t &pix)
+{
+    int r = (int) (pix.x * 255.0f + 0.5f);
+    int g = (int) (pix.y * 255.0f + 0.5f);
+    int b = (int) (pix.z * 255.0f + 0.5f);
+    return (77 * r + 150 * g + 29 * b + 128) >> 8;
+}
+
+static void lumRowInt(int *pL, const F4_t *pRow, const int width)
+{
+    for (int x = 0; x < width; x++) {
+        pL[x] = lumInt(pRow[x]);
+    }
+}
+
+void SEAMC_sobelInt( //
+        uint16_t** resultMatrix, const F4_t **srcImg, //
+        const int width, const int height, const int fromRow, const int toRow)
+{
+    int *L = np_new_array<int>(3 * width);
+    int *pB = L, *pC = L + width, *pA = L + 2 * width; // Rows y - 1, y, y + 1 (clipped)
+    
+    for (int y = fromRow; y < toRow; y++) {
+        lumRowInt(pB, srcImg[max(y - 1, 0)], width);
+        lumRowInt(pC, srcImg[y], width);
+        lumRowInt(pA, srcImg[min(y + 1, height - 1)], width);
+        
+        uint16_t *pResultRow = resultMatrix[y];
+        for (int x = 0; x < width; x++) {
+            const int xl = max(x - 1, 0), xr = min(x + 1, width - 1);
+            int gx = pB[xr] - pB[xl] + pA[xr] - pA[xl] + 2 * (pC[xr] - pC[xl]);
+            int gy = pA[xl] - pB[xl] + pA[xr] - pB[xr] + 2 * (pA[x] - pB[x]);
+            pResultRow[x] = (uint16_t) (abs(gx) + abs(gy)); // At most 2 * 4 * 255
+        }
+    }
+    np_free_array<int>(L);
+}
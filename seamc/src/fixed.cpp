@@ -0,0 +1,91 @@
+/* Fixed point versions of the DP and backtrack in seamc.cpp.
+ **
+ ** Same recurrence and the same tie rules as the float path, so any seam
+ **   that differs is down to quantization (or saturation), not the walk.
+ */
+
+#include "fixed.h"
+#include "seamc.h"
+
+#include <math.h>
+#include <algorithm>
+
+using namespace std;
+
+void SEAMC_quantizeRows(uint16_t **Q, float **G, int width, int fromRow, int toRow)
+{
+    for (int y = fromRow; y < toRow; y++) {
+        const float *pG_y = G[y];
+        uint16_t *pQ_y = Q[y];
+        for (int x = 0; x < width; x++) {
+            float q = pG_y[x] * SEAMC_FIXED_SCALE + 0.5f;
+            pQ_y[x] = (q >= 65535.0f) ? 65535 : (q <= 0.0f) ? 0 : (uint16_t) q;
+        }
+    }
+}
+
+// Saturating add, counting every cell that hit the ceiling
+static inline uint32_t addSat(uint32_t cost, uint16_t energy, long &nSat)
+{
+    uint32_t sum = cost + energy;
+    if (sum < cost) {
+        nSat++;
+        return SEAMC_COST_SAT;
+    }
+    return sum;
+}
+
+/* Returns the number of saturated cells.  Once a path saturates it ties
+ ** with every other saturated path, so non-zero means the seam is arbitrary.
+ */
+long SEAMC_dpFixed(uint32_t **Y, uint16_t **Q, int width, int height)
+{
+    int width_m1 = width - 1;
+    const uint16_t *pQ_y;
+    uint32_t *pY_y, *pY_yp;
+    long nSat = 0;
+    
+    pQ_y = Q[0];
+    pY_y = Y[0];
+    for (int x = 0; x <= width_m1; x++) {
+        pY_y[x] = pQ_y[x]; // Top row just gets copied
+    }
+    for (int y = 1; y < height; y++) {
+        pQ_y = Q[y];
+        pY_y = Y[y];
+        pY_yp = Y[y - 1];
+        
+        pY_y[0] = addSat(min(pY_yp[0], pY_yp[1]), pQ_y[0], nSat);
+        for (int x = 1; x < width_m1; x++) {
+            uint32_t pathCost = min(min(pY_yp[x - 1], pY_yp[x]), pY_yp[x + 1]);
+            pY_y[x] = addSat(pathCost, pQ_y[x], nSat);
+        }
+        pY_y[width_m1] = addSat(min(pY_yp[width_m1], pY_yp[width_m1 - 1]), pQ_y[width_m1], nSat);
+    }
+    return nSat;
+}
+
+void SEAMC_backtrackFixed(int *O, uint32_t **Y, int width, int height)
+{
+    int width_m1 = width - 1;
+    int height_m1 = height - 1;
+    uint32_t L, C, R;
+    const uint32_t *pY;
+    
+    pY = Y[height_m1];
+    int idx = 0;
+    for (int x = 1; x < width; x++) {
+        if (pY[x] < pY[idx]) idx = x;
+    }
+    O[height_m1] = idx;
+    
+    for (int y = height_m1 - 1; y >= 0; y--) {
+        pY = Y[y];
+        L = (idx < 1) ? SEAMC_COST_SAT : pY[idx - 1];
+        C = pY[idx];
+        R = (idx >= width_m1) ? SEAMC_COST_SAT : pY[idx + 1];
+        
+        idx += SEAMC_seamStep(L, C, R);
+        O[y] = idx;
+    }
+}
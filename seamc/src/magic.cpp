@@ -120,7 +120,8 @@ void** MW_ToMatrix(MagickWand *mw_in, int *pH, int *pW, bool isCOLOR)
     return M;
 }
 
-MagickWand* MW_Carve(const MagickWand *mw_in, int newH, int newW, bool isCOLOR, bool drawLINE)
+MagickWand* MW_Carve(const MagickWand *mw_in, int newH, int newW, bool isCOLOR, bool drawLINE,
+        bool leanDP, int precision, SEAMC_STATS_t *stats)
 {
     MagickBooleanType mw_ok;
     MagickWand* mw_temp = NewMagickWand();
@@ -136,19 +137,74 @@ MagickWand* MW_Carve(const MagickWand *mw_in, int newH, int newW, bool isCOLOR,
     if (mw_ok == MagickFalse) return NULL;
     
     int h, w;
+    SEAMC_TICK_t tick = SEAMC_tick();
     void** M_in = MW_ToMatrix(mw_temp, &h, &w, isCOLOR); // Zero col & row indicate ALL col & rows
     mw_temp = DestroyMagickWand(mw_temp);
+    SEAMC_tock(stats, SEAMC_IO, tick);
     
-    void** M_out = SEAMC_carve(M_in, w, h, newW, newH, isCOLOR, drawLINE);
+    void** M_out = SEAMC_carve(M_in, w, h, newW, newH, isCOLOR, drawLINE, leanDP,
+            precision, stats);
     M_in = (void**) np_free_matrix<float>((float**) M_in);
     
     // Don't actually shrink if just drawing lines
+    tick = SEAMC_tick();
     mw_temp = MW_FromMatrix(M_out, (drawLINE) ? h : newH, (drawLINE) ? w : newW, isCOLOR);
     M_out = (void**) np_free_matrix<float>((float**) M_out);
+    SEAMC_tock(stats, SEAMC_IO, tick);
     
     return mw_temp;
 }
 
+/* Color only.  Pixels go straight from the wand into a file-backed matrix a
+ ** row at a time (no clone of the input), and come back out the same way.
+ */
+MagickWand* MW_CarveOOC(MagickWand *mw_in, int newH, int newW, const SEAMC_OOC_t *ooc,
+        bool drawLINE, SEAMC_STATS_t *stats)
+{
+    MagickBooleanType mw_ok;
+    int h = MagickGetImageHeight(mw_in);
+    int w = MagickGetImageWidth(mw_in);
+    if ((h < 1) || (w < 1)) return NULL;
+    
+    NP_MAP_t *IMG = np_map_matrix_x(ooc->swapPath, h, w, sizeof(F4_t));
+    if (!IMG) {
+        fprintf(stderr, "Could not map %d x %d image to %s\n", w, h,
+                (ooc->swapPath) ? ooc->swapPath : "a temp file");
+        return NULL;
+    }
+    const int stripH = SEAMC_stripRows(w, h, ooc->budgetBytes);
+    SEAMC_TICK_t tick = SEAMC_tick();
+    
+    mw_ok = MagickTrue;
+    for (int y = 0; ((mw_ok != MagickFalse) && (y < h)); y++) {
+        mw_ok = MagickExportImagePixels(mw_in, 0, y, w, 1, "RGBA", FloatPixel, IMG->rows[y]);
+        if (((y + 1) % stripH) == 0) np_release_rows(IMG, y + 1 - stripH, y + 1);
+    }
+    if (mw_ok == MagickFalse) {
+        IMG = np_unmap_matrix_x(IMG);
+        return NULL;
+    }
+    
+    SEAMC_tock(stats, SEAMC_IO, tick);
+    
+    SEAMC_carveStrips(IMG, w, h, newW, ooc->budgetBytes, drawLINE, stats);
+    
+    // Don't actually shrink if just drawing lines
+    tick = SEAMC_tick();
+    const int outW = (drawLINE) ? w : newW;
+    MagickWand* mw_out = MW_Blank(h, outW, NULL);
+    mw_ok = (mw_out) ? MagickTrue : MagickFalse;
+    for (int y = 0; ((mw_ok != MagickFalse) && (y < h)); y++) {
+        mw_ok = MagickImportImagePixels(mw_out, 0, y, outW, 1, "RGBA", FloatPixel, IMG->rows[y]);
+        if (((y + 1) % stripH) == 0) np_release_rows(IMG, y + 1 - stripH, y + 1);
+    }
+    IMG = np_unmap_matrix_x(IMG);
+    SEAMC_tock(stats, SEAMC_IO, tick);
+    if ((mw_ok == MagickFalse) && mw_out) mw_out = DestroyMagickWand(mw_out);
+    
+    return mw_out;
+}
+
 // Demonstrates an iterator method of pixel access from example code using Wand only:
 MagickWand* IntMatrixToNewImage(int** M, int img_width, int img_height)
 {
@@ -16,7 +16,9 @@
 
 void process(const char *in_file, const char *out_file, //
         int out_width, int out_height, //
-        bool isCOLOR = true, bool drawLINE = false)
+        bool isCOLOR = true, bool drawLINE = false, const SEAMC_OOC_t *ooc = NULL,
+        bool leanDP = false, int precision = SEAMC_FLOAT, //
+        const char *statsFormat = NULL, const char *statsFile = NULL, const char *seamFile = NULL)
 {
     MagickWand *magick_wand = NULL;
     MagickBooleanType status;
@@ -24,6 +26,11 @@ void process(const char *in_file, const char *out_file, //
     
     // Initialize ImageMagick
     MagickWandGenesis();
+    if (ooc) {
+        // Keep ImageMagick's own pixel cache inside the budget too (it spills to disk)
+        MagickSetResourceLimit(MemoryResource, ooc->budgetBytes);
+        MagickSetResourceLimit(MapResource, ooc->budgetBytes);
+    }
     
     // Load image from file
     magick_wand = NewMagickWand();
@@ -38,7 +45,19 @@ void process(const char *in_file, const char *out_file, //
     
     printf("(w x h) IN: %i x %i  OUT: %i x %i\n", img_width, img_height, out_width, out_height);
     
-    MagickWand* mw_out = MW_Carve(magick_wand, out_height, out_width, isCOLOR, drawLINE); // color, lines
+    const char *baseName = strrchr(in_file, '/');
+    SEAMC_STATS_t *stats = (statsFormat || seamFile) ?
+            SEAMC_newStats((baseName) ? baseName + 1 : in_file, img_width, img_height,
+                    img_width - out_width) : NULL;
+    if (seamFile && stats) {
+        stats->seamLog = fopen(seamFile, "w");
+        if (!stats->seamLog) fprintf(stderr, "Could not write seams to %s\n", seamFile);
+    }
+    
+    MagickWand* mw_out = (ooc) ?
+            MW_CarveOOC(magick_wand, out_height, out_width, ooc, drawLINE, stats) :
+            MW_Carve(magick_wand, out_height, out_width, isCOLOR, drawLINE, leanDP, precision,
+                    stats);
     if (mw_out) {
         status = MagickWriteImage(mw_out, out_file);
         if (DBG_DUMPIMG) {
@@ -52,6 +71,16 @@ void process(const char *in_file, const char *out_file, //
         mw_out = DestroyMagickWand(mw_out);
     } else fprintf(stderr, "Error Carving Image.\n");
     
+    if (stats && stats->seamLog) fclose(stats->seamLog);
+    if (statsFormat && stats) {
+        FILE *out = (statsFile) ? fopen(statsFile, "w") : stdout;
+        if (out) {
+            SEAMC_writeStats(out, stats, (strcmp(statsFormat, "json") == 0));
+            if (out != stdout) fclose(out);
+        } else fprintf(stderr, "Could not write stats to %s\n", statsFile);
+    }
+    stats = SEAMC_freeStats(stats);
+    
     // Tidy up
     magick_wand = DestroyMagickWand(magick_wand);
     
@@ -59,13 +88,26 @@ void process(const char *in_file, const char *out_file, //
     MagickWandTerminus();
 }
 
+static const int DEFAULT_OOC_MB = 256;
+
 /**
  * Prints the expected command-line args.
  */
 void usage(void)
 {
-    printf("usage: <image.{jpg,png,tif,...}> [<outimg.xyz> [<new-width> [<new-height>]]]\n");
+    printf("usage: [options] <image.{jpg,png,tif,...}> [<outimg.xyz> [<new-width> [<new-height>]]]\n");
     printf("     : new-width/height may be a negative number to indicate relative shrink.\n");
+    printf("options:\n");
+    printf("     --ooc[=<MB>]    : out-of-core, stream the image from disk in strips (default %d MB)\n",
+            DEFAULT_OOC_MB);
+    printf("     --swap=<file>   : backing file for --ooc (default: unlinked file in $TMPDIR)\n");
+    printf("     --lean          : keep only sqrt(height) cost rows, recomputing them for the backtrack\n");
+    printf("     --precision=<p> : float (default), fixed (uint16 energy, uint32 cost), compare\n");
+    printf("                       (carve with float, report how many seams fixed would change)\n");
+    printf("                       or int (seamcl's integer Sobel energy, same seams as seamcl)\n");
+    printf("     --stats=<fmt>   : per-stage timings as json or csv (andromeda.csv columns)\n");
+    printf("     --stats-out=<f> : write the stats to a file rather than stdout\n");
+    printf("     --dump-seams=<f>: write every seam to a file (ref_images carves format)\n");
 }
 
 /**
@@ -73,6 +115,56 @@ void usage(void)
  */
 int main(int argc, char *argv[])
 {
+    // Pull out the --options, leaving just the positional args in argv
+    SEAMC_OOC_t OOC = { (size_t) DEFAULT_OOC_MB << 20, NULL };
+    bool useOOC = false;
+    bool leanDP = false;
+    int precision = SEAMC_FLOAT;
+    const char *statsFormat = NULL, *statsFile = NULL, *seamFile = NULL;
+    int nArgs = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) != 0) {
+            argv[nArgs++] = argv[i];
+        } else if (strcmp(argv[i], "--ooc") == 0) {
+            useOOC = true;
+        } else if (strncmp(argv[i], "--ooc=", 6) == 0) {
+            useOOC = true;
+            OOC.budgetBytes = (size_t) atol(argv[i] + 6) << 20;
+        } else if (strcmp(argv[i], "--lean") == 0) {
+            leanDP = true;
+        } else if (strncmp(argv[i], "--precision=", 12) == 0) {
+            const char *p = argv[i] + 12;
+            if (strcmp(p, "float") == 0) precision = SEAMC_FLOAT;
+            else if (strcmp(p, "fixed") == 0) precision = SEAMC_FIXED;
+            else if (strcmp(p, "compare") == 0) precision = SEAMC_COMPARE;
+            else if (strcmp(p, "int") == 0) precision = SEAMC_INTEGER;
+            else {
+                printf("unknown precision %s\n", p);
+                usage();
+                exit(-1);
+            }
+        } else if (strncmp(argv[i], "--stats=", 8) == 0) {
+            statsFormat = argv[i] + 8;
+            if ((strcmp(statsFormat, "json") != 0) && (strcmp(statsFormat, "csv") != 0)) {
+                printf("unknown stats format %s\n", statsFormat);
+                usage();
+                exit(-1);
+            }
+        } else if (strncmp(argv[i], "--stats-out=", 12) == 0) {
+            statsFile = argv[i] + 12;
+        } else if (strncmp(argv[i], "--dump-seams=", 13) == 0) {
+            seamFile = argv[i] + 13;
+        } else if (strncmp(argv[i], "--swap=", 7) == 0) {
+            useOOC = true;
+            OOC.swapPath = argv[i] + 7;
+        } else {
+            printf("unknown option %s\n", argv[i]);
+            usage();
+            exit(-1);
+        }
+    }
+    argc = nArgs;
+    
     if (argc < 2) {
         printf("argc = %i\n", argc);
         usage();
@@ -88,7 +180,22 @@ int main(int argc, char *argv[])
         int new_height = (argc > 4) ? atoi(argv[4]) : 0;
         printf("%s -> %s (%d x %d)\n", inFile, outFile, new_width, new_height);
         
-        process(inFile, outFile, new_width, new_height, isCOLOR, drawLINE);
+        if (useOOC && !isCOLOR) {
+            fprintf(stderr, "--ooc only supports color, carving in memory.\n");
+            useOOC = false;
+        }
+        if (precision != SEAMC_FLOAT) {
+            // The fixed point scale is set for the color gradient's range
+            if (!isCOLOR) {
+                fprintf(stderr, "--precision only supports color, using float.\n");
+                precision = SEAMC_FLOAT;
+            } else if (useOOC) {
+                fprintf(stderr, "--ooc is float only, ignoring --precision.\n");
+                precision = SEAMC_FLOAT;
+            }
+        }
+        process(inFile, outFile, new_width, new_height, isCOLOR, drawLINE, (useOOC) ? &OOC : NULL,
+                leanDP, precision, statsFormat, statsFile, seamFile);
     }
 }
 
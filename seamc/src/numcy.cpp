@@ -4,6 +4,10 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 /* Currently allocates a contiguous block but still returns array
  ** of arrays, allowing double indirection to access elements.
@@ -39,6 +43,86 @@ void** np_free_matrix_x(void** M)
     return NULL;
 }
 
+/* path may be NULL, in which case an unlinked temp file in $TMPDIR is used.
+ ** Any existing file at path is truncated.
+ */
+NP_MAP_t* np_map_matrix_x(const char *path, size_t height, size_t width, size_t sz)
+{
+    char tmpPath[1024];
+    int fd;
+    
+    if (path) {
+        fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    } else {
+        const char *tmpDir = getenv("TMPDIR");
+        snprintf(tmpPath, sizeof(tmpPath), "%s/seamc-XXXXXX", (tmpDir) ? tmpDir : "/tmp");
+        fd = ::mkstemp(tmpPath);
+        if (fd >= 0) ::unlink(tmpPath); // Goes away with the last reference
+    }
+    if (fd < 0) return NULL;
+    
+    size_t rowBytes = width * sz;
+    size_t bytes = height * rowBytes;
+    if (::ftruncate(fd, bytes) != 0) {
+        ::close(fd);
+        return NULL;
+    }
+    char *base = (char*) ::mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        ::close(fd);
+        return NULL;
+    }
+    
+    NP_MAP_t *MAP = (NP_MAP_t*) ::calloc(1, sizeof(NP_MAP_t));
+    void **arrarr = (void**) ::malloc(height * sizeof(void*));
+    if (!MAP || !arrarr) {
+        if (MAP) ::free(MAP);
+        if (arrarr) ::free(arrarr);
+        ::munmap(base, bytes);
+        ::close(fd);
+        return NULL;
+    }
+    for (size_t y = 0; y < height; y++) {
+        arrarr[y] = base + (y * rowBytes);
+    }
+    MAP->rows = arrarr;
+    MAP->base = base;
+    MAP->bytes = bytes;
+    MAP->rowBytes = rowBytes;
+    MAP->fd = fd;
+    return MAP;
+}
+
+NP_MAP_t* np_unmap_matrix_x(NP_MAP_t *MAP)
+{
+    if (MAP) {
+        ::munmap(MAP->base, MAP->bytes);
+        ::close(MAP->fd);
+        ::free(MAP->rows);
+        ::free(MAP);
+    }
+    return NULL;
+}
+
+/* Drops [fromRow, toRow) from our resident set.  Dirty pages are scheduled
+ ** for write-back first; the data stays valid and is faulted back in on
+ ** the next access.
+ */
+void np_release_rows(NP_MAP_t *MAP, size_t fromRow, size_t toRow)
+{
+    static const size_t pageSize = ::sysconf(_SC_PAGESIZE);
+    if (!MAP || (toRow <= fromRow)) return;
+    
+    // madvise wants page aligned ranges; only drop pages fully inside the rows
+    size_t from = fromRow * MAP->rowBytes, to = toRow * MAP->rowBytes;
+    from = (from + pageSize - 1) / pageSize * pageSize;
+    to = to / pageSize * pageSize;
+    if (to <= from) return;
+    
+    ::msync(MAP->base + from, to - from, MS_ASYNC);
+    ::madvise(MAP->base + from, to - from, MADV_DONTNEED);
+}
+
 void DebugMatrix(void **IMG, int W, int H, const char* name, int remainWidth, bool isCOLOR)
 {
     if (DBG_DUMPTXT) {
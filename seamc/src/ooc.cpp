@@ -0,0 +1,191 @@
+/* Strip-streamed (out-of-core) version of SEAMC_carve.
+ **
+ ** Each seam takes one forward pass that computes energy and DP a strip at
+ **   a time, keeping only the cost row just above each strip (a checkpoint).
+ **   The backtrack then walks the strips bottom-up, recomputing each strip's
+ **   cost from its checkpoint.  Carving the previous seam is folded into the
+ **   next forward pass so the image is only streamed twice per seam.
+ */
+
+#include "ooc.h"
+#include "seamc.h"
+#include "energy.h"
+#include "numcy.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+// Working bytes per pixel of a strip row: BLUR 16, GRAD 4, COST 4, plus the
+//   16 bytes of mapped image rows that are resident while the strip is live.
+static const size_t STRIP_BYTES_PER_PIX = 40;
+static const int STRIP_MIN_ROWS = 4;
+
+/* Tallest strip such that the strip buffers plus one checkpoint row per
+ ** strip fit in budgetBytes.  Never less than STRIP_MIN_ROWS, so a tiny
+ ** budget is exceeded rather than refused.
+ */
+int SEAMC_stripRows(int width, int height, size_t budgetBytes)
+{
+    const size_t rowBytes = width * STRIP_BYTES_PER_PIX;
+    const size_t ckptBytes = width * sizeof(float);
+    int rows = (int) min<size_t>(height, budgetBytes / rowBytes);
+    while (rows > STRIP_MIN_ROWS) {
+        size_t numStrips = (height + rows - 1) / rows;
+        if ((rows * rowBytes) + (numStrips * ckptBytes) <= budgetBytes) break;
+        rows--;
+    }
+    return max(rows, min(height, STRIP_MIN_ROWS));
+}
+
+/* The row tables span the full height (so the regular SEAMC_* functions can
+ **   index them with image rows), but only rows of the current strip point
+ **   at storage.  Cost rows and their checkpoints come from a SEAMC_CKPT_t
+ **   with one segment per strip.
+ */
+typedef struct SEAMC_STRIPS {
+    int height, stripH, numStrips;
+    float **GRAD;
+    F4_t **BLUR;
+    float *gradStore;
+    F4_t *blurStore;
+    SEAMC_CKPT_t *CK;
+    SEAMC_STATS_t *stats;
+    SEAMC_TICK_t tick; // Start of the current stage
+} SEAMC_STRIPS_t;
+
+static void stripRange(const SEAMC_STRIPS_t &ST, int s, int *pFrom, int *pTo)
+{
+    *pFrom = s * ST.stripH;
+    *pTo = min(ST.height, *pFrom + ST.stripH);
+}
+
+static void pointStrip(SEAMC_STRIPS_t &ST, int pitch, int s)
+{
+    int y0, y1;
+    stripRange(ST, s, &y0, &y1);
+    for (int y = y0; y < y1; y++) {
+        ST.GRAD[y] = ST.gradStore + (y - y0) * pitch;
+    }
+    // Blur needs a one row halo on each side for the gradient stencil
+    for (int y = max(0, y0 - 1); y < min(ST.height, y1 + 1); y++) {
+        ST.BLUR[y] = ST.blurStore + (y - y0 + 1) * pitch;
+    }
+}
+
+// Energy and DP for strip s; its cost segment must already be pointed at.
+static void computeStrip(SEAMC_STRIPS_t &ST, void **srcIM, int width, int s)
+{
+    int y0, y1;
+    stripRange(ST, s, &y0, &y1);
+    SEAMC_gaussian(ST.BLUR, (const F4_t**) srcIM, width, ST.height, max(0, y0 - 1),
+            min(ST.height, y1 + 1));
+    SEAMC_gradient(ST.GRAD, const_cast<const F4_t**>(ST.BLUR), width, ST.height, y0, y1);
+    SEAMC_tock(ST.stats, SEAMC_ENERGY, ST.tick);
+    SEAMC_dpRows(ST.CK->Y, ST.GRAD, width, y0, y1);
+    SEAMC_tock(ST.stats, SEAMC_DP, ST.tick);
+}
+
+void SEAMC_carveStrips(NP_MAP_t *IMG, int inW, int inH, int newW, size_t budgetBytes,
+        bool drawLINE, SEAMC_STATS_t *stats)
+{
+    const int pixBytes = sizeof(F4_t);
+    void **srcIM = IMG->rows;
+    
+    SEAMC_STRIPS_t ST;
+    ST.height = inH;
+    ST.stripH = SEAMC_stripRows(inW, inH, budgetBytes);
+    ST.numStrips = (inH + ST.stripH - 1) / ST.stripH;
+    ST.GRAD = np_zero_array<float*>(inH);
+    ST.BLUR = np_zero_array<F4_t*>(inH);
+    ST.gradStore = np_new_array<float>((size_t) ST.stripH * inW);
+    ST.blurStore = np_new_array<F4_t>((size_t) (ST.stripH + 2) * inW);
+    ST.CK = SEAMC_newCheckpoints(inW, inH, ST.stripH);
+    ST.stats = stats;
+    int32_t* CARVE = np_zero_array<int32_t>(inH);
+    
+    fprintf(stderr, "Out-of-core: %d strips of %d rows (%.1f MB budget)\n", ST.numStrips,
+            ST.stripH, budgetBytes / (1024.0 * 1024.0));
+    
+    int width = inW;
+    int carvedTo = inH; // Rows below this still need the previous seam carved out
+    int remainWidth = inW;
+    while (remainWidth > newW) {
+        SEAMC_TICK_t start_tick = ST.tick = SEAMC_tick();
+        
+        // Forward pass: carve the last seam just ahead of the energy stencil
+        int releasedTo = 0;
+        for (int s = 0; s < ST.numStrips; s++) {
+            int y0, y1;
+            stripRange(ST, s, &y0, &y1);
+            
+            int carveTo = min(inH, y1 + 2);
+            if (carvedTo < carveTo) {
+                if (drawLINE) {
+                    SEAMC_lineKernel(srcIM + carvedTo, srcIM + carvedTo, width, carveTo - carvedTo,
+                            CARVE + carvedTo, pixBytes);
+                } else {
+                    // width + 1: the seam was found before width was decremented
+                    SEAMC_carveKernel(srcIM + carvedTo, srcIM + carvedTo, width + 1,
+                            carveTo - carvedTo, CARVE + carvedTo, pixBytes);
+                }
+                carvedTo = carveTo;
+                SEAMC_tock(stats, SEAMC_CARVE, ST.tick);
+            }
+            
+            SEAMC_ckptSegment(ST.CK, s, width, true, &y0, &y1);
+            pointStrip(ST, inW, s);
+            computeStrip(ST, srcIM, width, s);
+            
+            np_release_rows(IMG, releasedTo, max(0, y1 - 2));
+            releasedTo = max(releasedTo, y1 - 2);
+            SEAMC_tock(stats, SEAMC_IO, ST.tick);
+        }
+        
+        // Backtrack: the bottom strip's cost is still in place, the rest is recomputed
+        int idx = SEAMC_argminRow(ST.CK->Y[inH - 1], width);
+        CARVE[inH - 1] = idx;
+        for (int s = ST.numStrips - 1; s >= 0; s--) {
+            int y0, y1;
+            stripRange(ST, s, &y0, &y1);
+            if (s < ST.numStrips - 1) {
+                SEAMC_ckptSegment(ST.CK, s, width, false, &y0, &y1);
+                pointStrip(ST, inW, s);
+                computeStrip(ST, srcIM, width, s);
+            }
+            idx = SEAMC_backtrackRows(CARVE, ST.CK->Y, width, y0, min(y1, inH - 1), idx);
+            SEAMC_tock(stats, SEAMC_BACKTRACK, ST.tick);
+            np_release_rows(IMG, max(0, y0 - 2), min(inH, y1 + 2));
+            SEAMC_tock(stats, SEAMC_IO, ST.tick);
+        }
+        carvedTo = 0;
+        SEAMC_logSeam(stats, CARVE, width, inH);
+        
+        double elapsed = SEAMC_statsIteration(stats, start_tick) * 1e-9;
+        fprintf(stderr, "%f sec this iteration (%d)\n", elapsed, remainWidth);
+        
+        if (!drawLINE) width--;
+        remainWidth--;
+    }
+    
+    // The last seam has not been carved yet
+    if (carvedTo < inH) {
+        if (drawLINE) {
+            SEAMC_lineKernel(srcIM + carvedTo, srcIM + carvedTo, width, inH - carvedTo,
+                    CARVE + carvedTo, pixBytes);
+        } else {
+            SEAMC_carveKernel(srcIM + carvedTo, srcIM + carvedTo, width + 1, inH - carvedTo,
+                    CARVE + carvedTo, pixBytes);
+        }
+    }
+    np_release_rows(IMG, 0, inH);
+    
+    CARVE = np_free_array<int32_t>(CARVE);
+    ST.CK = SEAMC_freeCheckpoints(ST.CK);
+    ST.blurStore = np_free_array<F4_t>(ST.blurStore);
+    ST.gradStore = np_free_array<float>(ST.gradStore);
+    ST.BLUR = np_free_array<F4_t*>(ST.BLUR);
+    ST.GRAD = np_free_array<float*>(ST.GRAD);
+}
@@ -7,6 +7,7 @@
 #include "energy.h"
 #include "energy_grey.h"
 #include "numcy.h"
+#include "fixed.h"
 #include "magic.h"
 
 #include <stdio.h>
@@ -18,16 +19,27 @@ using namespace std;
 
 void SEAMC_dp(float **Y, float **G, int width, int height)
 {
-    int height_m1 = height - 1, width_m1 = width - 1;
+    SEAMC_dpRows(Y, G, width, 0, height);
+} // def dp(Y,G):
+
+/* Rows [fromRow, toRow) only.  Unless fromRow is the top, Y[fromRow - 1]
+ ** must already hold the cost of the row above (it's the only one read).
+ */
+void SEAMC_dpRows(float **Y, float **G, int width, int fromRow, int toRow)
+{
+    int width_m1 = width - 1;
     const float *pG_y;
     float *pY_y, *pY_yp;
     
-    pG_y = G[0];
-    pY_y = Y[0];
-    for (int x = 0; x <= width_m1; x++) {
-        pY_y[x] = pG_y[x]; // Top row just gets copied
+    if (fromRow == 0) {
+        pG_y = G[0];
+        pY_y = Y[0];
+        for (int x = 0; x <= width_m1; x++) {
+            pY_y[x] = pG_y[x]; // Top row just gets copied
+        }
+        fromRow = 1;
     }
-    for (int y = 1; y <= height_m1; y++) {
+    for (int y = fromRow; y < toRow; y++) {
         pG_y = G[y];
         pY_y = Y[y];
         pY_yp = Y[y - 1];
@@ -80,41 +92,135 @@ void SEAMC_zeroKernel(void **Y, int width, int height, int pixBytes)
 
 void SEAMC_backtrack(int *O, float **Y, int width, int height)
 {
-    int width_m1 = width - 1, height_m1 = height - 1;
-    float min_v, L, C, R;
-    const float *pY;
-    int idx = 0;
+    int height_m1 = height - 1;
+    int idx = SEAMC_argminRow(Y[height_m1], width);
     
-    int y = height_m1;
-    int x = idx;
-    pY = Y[y];
-    min_v = pY[x];
-    while (++x <= width_m1) {
+    /* printf("idx=%d, min_v=%f\n", idx, Y[height_m1][idx]); */
+    O[height_m1] = idx;
+    SEAMC_backtrackRows(O, Y, width, 0, height_m1, idx);
+} // def backtrack(Y,O):
+
+int SEAMC_argminRow(const float *pY, int width)
+{
+    int idx = 0;
+    float min_v = pY[0];
+    for (int x = 1; x < width; x++) {
         if (pY[x] < min_v) {
             min_v = pY[x];
             idx = x;
         }
     }
+    return idx;
+}
+
+/* Walks up from column idx on row toRow, filling O[toRow - 1] down to
+ ** O[fromRow].  Only Y rows in [fromRow, toRow) are read, so a strip can be
+ ** backtracked with just its own cost rows.  Returns the column at fromRow.
+ */
+int SEAMC_backtrackRows(int *O, float **Y, int width, int fromRow, int toRow, int idx)
+{
+    int width_m1 = width - 1;
+    float L, C, R;
+    const float *pY;
     
-    /* printf("idx=%d, min_v=%f\n", idx, min_v); */
-    O[y] = idx;
-    while (--y >= 0) {
+    int y = toRow;
+    while (--y >= fromRow) {
         pY = Y[y];
         L = (idx < 1) ? FLT_MAX : pY[idx - 1];
         C = pY[idx];
         R = (idx >= width_m1) ? FLT_MAX : pY[idx + 1];
         
-        if (L < C) {
-            idx += (L < R) ? -1 : 1;
-        } else {
-            idx += (C < R) ? 0 : 1;
-        }
+        idx += SEAMC_seamStep(L, C, R);
         /* printf("i=%d,idx=%d\n", i, idx); */
         O[y] = idx;
     }
-} // def backtrack(Y,O):
+    return idx;
+}
+
+/* k <= 0 picks sqrt(height), which minimizes checkpoints + scratch rows.
+ */
+SEAMC_CKPT_t* SEAMC_newCheckpoints(int width, int height, int k)
+{
+    if (k <= 0) k = (int) ceil(sqrt((double) height));
+    k = min(max(k, 1), height);
+    
+    SEAMC_CKPT_t *CK = (SEAMC_CKPT_t*) np_zero_array<SEAMC_CKPT_t>(1);
+    if (!CK) return NULL;
+    CK->height = height;
+    CK->pitch = width;
+    CK->k = k;
+    CK->numSegs = (height + k - 1) / k;
+    CK->CKPT = np_zero_matrix<float>(CK->numSegs, width, NULL);
+    CK->Y = np_zero_array<float*>(height);
+    CK->store = np_zero_array<float>((size_t) k * width);
+    if (!CK->CKPT || !CK->Y || !CK->store) return SEAMC_freeCheckpoints(CK);
+    return CK;
+}
+
+SEAMC_CKPT_t* SEAMC_freeCheckpoints(SEAMC_CKPT_t *CK)
+{
+    if (CK) {
+        CK->CKPT = np_free_matrix<float>(CK->CKPT);
+        CK->Y = np_free_array<float*>(CK->Y);
+        CK->store = np_free_array<float>(CK->store);
+        np_free_array<SEAMC_CKPT_t>(CK);
+    }
+    return NULL;
+}
 
-void** SEAMC_carve(void **iM, int inW, int inH, int newW, int newH, bool isCOLOR, bool drawLINE)
+/* Points the Y rows of segment s at the scratch store and Y[from - 1] at its
+ ** checkpoint, so SEAMC_dpRows() can (re)compute the segment.  With save the
+ ** checkpoint is first taken from the previous segment, which must be the
+ ** one currently in the store.
+ */
+void SEAMC_ckptSegment(SEAMC_CKPT_t *CK, int s, int width, bool save, int *pFrom, int *pTo)
+{
+    const int y0 = s * CK->k;
+    const int y1 = min(CK->height, y0 + CK->k);
+    
+    if (save && (s > 0)) ::memcpy(CK->CKPT[s], CK->Y[y0 - 1], width * sizeof(float));
+    for (int y = y0; y < y1; y++) {
+        CK->Y[y] = CK->store + (y - y0) * CK->pitch;
+    }
+    if (s > 0) CK->Y[y0 - 1] = CK->CKPT[s];
+    
+    *pFrom = y0;
+    *pTo = y1;
+}
+
+void SEAMC_dpCheckpoint(SEAMC_CKPT_t *CK, float **G, int width)
+{
+    int y0, y1;
+    for (int s = 0; s < CK->numSegs; s++) {
+        SEAMC_ckptSegment(CK, s, width, true, &y0, &y1);
+        SEAMC_dpRows(CK->Y, G, width, y0, y1);
+    }
+}
+
+/* Expects SEAMC_dpCheckpoint() to have just run: the bottom segment is still
+ ** in the store, every other one is recomputed from its checkpoint.
+ */
+void SEAMC_backtrackCheckpoint(int *O, SEAMC_CKPT_t *CK, float **G, int width)
+{
+    const int height_m1 = CK->height - 1;
+    int y0, y1;
+    
+    int idx = SEAMC_argminRow(CK->Y[height_m1], width);
+    O[height_m1] = idx;
+    for (int s = CK->numSegs - 1; s >= 0; s--) {
+        if (s < CK->numSegs - 1) {
+            SEAMC_ckptSegment(CK, s, width, false, &y0, &y1);
+            SEAMC_dpRows(CK->Y, G, width, y0, y1);
+        } else {
+            y0 = s * CK->k;
+            y1 = height_m1;
+        }
+        idx = SEAMC_backtrackRows(O, CK->Y, width, y0, y1, idx);
+    }
+}
+
+void** SEAMC_carve(void **iM, int inW, int inH, int newW, int newH, bool isCOLOR, bool drawLINE,
+        bool leanDP, int precision, SEAMC_STATS_t *stats)
 {
 //TODO: Error handling (out of memory, etc)
 //TODO: perhaps use the output matrix as the working copy rather than modifying the input matrix.
@@ -138,28 +244,47 @@ void** SEAMC_carve(void **iM, int inW, int inH, int newW, int newH, bool isCOLOR
     SEAMC_WORK_t WORK; // Consistent values across multiple SEAMC calls (rather than globals)
     int32_t* CARVE = np_zero_array<int32_t>(fullHeight);
     float** GRAD = np_zero_matrix<float>(fullHeight, fullWidth, NULL);
-    float** COST = np_zero_matrix<float>(fullHeight, fullWidth, NULL);
+    const bool useINT = (precision == SEAMC_INTEGER) && isCOLOR;
+    if ((precision == SEAMC_INTEGER) && !isCOLOR) {
+        fprintf(stderr, "Integer energy is colour only, using float.\n");
+        precision = SEAMC_FLOAT;
+    }
+    if (leanDP && (precision != SEAMC_FLOAT)) {
+        fprintf(stderr, "Lean DP is float only, using the full cost matrix.\n");
+        leanDP = false;
+    }
+    const bool useFLOAT = (precision != SEAMC_FIXED) && !useINT;
+    const bool useFIXED = (precision != SEAMC_FLOAT);
+    float** COST = (leanDP || !useFLOAT) ? NULL : np_zero_matrix<float>(fullHeight, fullWidth, NULL);
+    SEAMC_CKPT_t* CK = (leanDP) ? SEAMC_newCheckpoints(fullWidth, fullHeight) : NULL;
+    uint16_t** QGRAD = (useFIXED) ? np_zero_matrix<uint16_t>(fullHeight, fullWidth, NULL) : NULL;
+    uint32_t** QCOST = (useFIXED) ? np_zero_matrix<uint32_t>(fullHeight, fullWidth, NULL) : NULL;
+    int32_t* QCARVE = (precision == SEAMC_COMPARE) ? np_zero_array<int32_t>(fullHeight) : NULL;
+    long numSat = 0, numDiffSeams = 0, numDiffRows = 0;
     F4_t** BLUR = (F4_t**) np_zero_matrix<float>(fullHeight, fullWidth * pixDepth, NULL);
     
     WORK.width = inW;
     WORK.height = inH;
     int remainWidth = inW, remainHeight = inH; // These count down even if we're drawing lines rather than carving
     while (remainWidth > newW) {   // TODO: Deal with stretch & vertical too!!!
-        WORK.start_time = time(NULL); // Epoch time
-        WORK.start_clock = clock(); // CPU usage
+        WORK.start_tick = WORK.stage_tick = SEAMC_tick();
         WORK.ydim = WORK.height - 3;
         WORK.xdim = WORK.width - 3;
         
         SEAMC_zeroKernel((void**) GRAD, WORK.width, WORK.height, sizeof(float));
-        SEAMC_zeroKernel((void**) COST, WORK.width, WORK.height, sizeof(float));
+        if (COST) SEAMC_zeroKernel((void**) COST, WORK.width, WORK.height, sizeof(float));
+        SEAMC_tock(stats, SEAMC_ZERO, WORK.stage_tick);
         
         DebugMatrix((void**) srcIM, WORK.width, WORK.height, "0_start", remainWidth, isCOLOR);
-        if (isCOLOR) {
+        if (useINT) {
+            SEAMC_sobelInt(QGRAD, (const F4_t**) srcIM, WORK.width, WORK.height, 0, WORK.height);
+        } else if (isCOLOR) {
             //SEAMC_glaplauxian(O, (const F4_t**) srcIM, WORK.width, WORK.height);
-            SEAMC_gaussian(BLUR, (const F4_t**) srcIM, WORK.width, WORK.height);
+            SEAMC_gaussian(BLUR, (const F4_t**) srcIM, WORK.width, WORK.height, 0, WORK.height);
             DebugMatrix((void**) BLUR, WORK.width, WORK.height, "1_blur", remainWidth, true);
             
-            SEAMC_gradient(GRAD, const_cast<const F4_t**>(BLUR), WORK.width, WORK.height);
+            SEAMC_gradient(GRAD, const_cast<const F4_t**>(BLUR), WORK.width, WORK.height, 0,
+                    WORK.height);
         } else {
             if (!KONV) {
                 KONV = np_zero_matrix<float>(5, 5, NULL);
@@ -175,11 +300,43 @@ void** SEAMC_carve(void **iM, int inW, int inH, int newW, int newH, bool isCOLOR
             //}
         }
         DebugMatrix((void**) GRAD, WORK.width, WORK.height, "2_grad", remainWidth, false);
+        SEAMC_tock(stats, SEAMC_ENERGY, WORK.stage_tick);
         
-        SEAMC_dp(COST, GRAD, WORK.width, WORK.height);
-        DebugMatrix((void**) COST, WORK.width, WORK.height, "3_cost", remainWidth, false);
-        
-        SEAMC_backtrack(CARVE, COST, WORK.width, WORK.height);
+        if (useFIXED) {
+            // Compare mode carves along the float seam, so the fixed one goes to the side
+            int32_t *pCARVE = (QCARVE) ? QCARVE : CARVE;
+            if (!useINT) {
+                SEAMC_quantizeRows(QGRAD, GRAD, WORK.width, 0, WORK.height);
+                SEAMC_tock(stats, SEAMC_ENERGY, WORK.stage_tick);
+            }
+            numSat += SEAMC_dpFixed(QCOST, QGRAD, WORK.width, WORK.height);
+            SEAMC_tock(stats, SEAMC_DP, WORK.stage_tick);
+            SEAMC_backtrackFixed(pCARVE, QCOST, WORK.width, WORK.height);
+            SEAMC_tock(stats, SEAMC_BACKTRACK, WORK.stage_tick);
+        }
+        if (useFLOAT) {
+            if (leanDP) {
+                SEAMC_dpCheckpoint(CK, GRAD, WORK.width);
+                SEAMC_tock(stats, SEAMC_DP, WORK.stage_tick);
+                SEAMC_backtrackCheckpoint(CARVE, CK, GRAD, WORK.width); // Includes the DP recompute
+            } else {
+                SEAMC_dp(COST, GRAD, WORK.width, WORK.height);
+                DebugMatrix((void**) COST, WORK.width, WORK.height, "3_cost", remainWidth, false);
+                SEAMC_tock(stats, SEAMC_DP, WORK.stage_tick);
+                
+                SEAMC_backtrack(CARVE, COST, WORK.width, WORK.height);
+            }
+            SEAMC_tock(stats, SEAMC_BACKTRACK, WORK.stage_tick);
+        }
+        if (QCARVE) {
+            int diffRows = 0;
+            for (int cy = 0; cy < WORK.height; cy++) {
+                if (QCARVE[cy] != CARVE[cy]) diffRows++;
+            }
+            if (diffRows) numDiffSeams++;
+            numDiffRows += diffRows;
+        }
+        SEAMC_logSeam(stats, CARVE, WORK.width, WORK.height);
         if (DBG_DUMPTXT) {
             fprintf(stdout, "CARV %d: ", WORK.width);
             for (int cy = 0; cy < WORK.height; cy++) {
@@ -191,12 +348,13 @@ void** SEAMC_carve(void **iM, int inW, int inH, int newW, int newH, bool isCOLOR
         if (drawLINE) {
             SEAMC_lineKernel(newM, srcIM, WORK.width, WORK.height, CARVE, pixDepth * sizeof(float));
         } else {
-            SEAMC_carveKernel(newM, srcIM, WORK.width - 1, WORK.height, CARVE,
-                    pixDepth * sizeof(float));
+            // Full width: the kernel moves columns [carve + 1, width) down by one
+            SEAMC_carveKernel(newM, srcIM, WORK.width, WORK.height, CARVE, pixDepth * sizeof(float));
         }
         srcIM = newM; // Copy in place from now on
-                
-        double elapsed = difftime(time(NULL), WORK.start_time);
+        SEAMC_tock(stats, SEAMC_CARVE, WORK.stage_tick);
+        
+        double elapsed = SEAMC_statsIteration(stats, WORK.start_tick) * 1e-9;
         fprintf(stderr, "%f sec this iteration (%d)\n", elapsed, remainWidth);
         
         if (!drawLINE) WORK.width--;
@@ -207,6 +365,16 @@ void** SEAMC_carve(void **iM, int inW, int inH, int newW, int newH, bool isCOLOR
     CARVE = np_free_array<int32_t>(CARVE);
     GRAD = np_free_matrix<float>(GRAD);
     COST = np_free_matrix<float>(COST);
+    CK = SEAMC_freeCheckpoints(CK);
+    QGRAD = np_free_matrix<uint16_t>(QGRAD);
+    QCOST = np_free_matrix<uint32_t>(QCOST);
+    QCARVE = np_free_array<int32_t>(QCARVE);
+    
+    if (precision == SEAMC_COMPARE) {
+        fprintf(stderr, "Fixed vs float: %ld of %d seams differ (%ld rows)\n", numDiffSeams,
+                inW - newW, numDiffRows);
+    }
+    if (numSat) fprintf(stderr, "Fixed point cost saturated in %ld cells\n", numSat);
     KONV = np_free_matrix<float>(KONV);
     BLUR = (F4_t**) np_free_matrix<float>((float**) BLUR);
     
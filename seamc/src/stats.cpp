@@ -0,0 +1,153 @@
+#include "stats.h"
+#include "numcy.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+using namespace std;
+
+static const char *STAGE_NAMES[SEAMC_NUM_STAGES] = { "energy", "dp", "backtrack", "carve", "zero",
+    "io" };
+
+SEAMC_STATS_t* SEAMC_newStats(const char *inputImage, int origWidth, int height, int maxSeams)
+{
+    SEAMC_STATS_t *S = np_zero_array<SEAMC_STATS_t>(1);
+    if (!S) return NULL;
+    S->inputImage = inputImage;
+    S->origWidth = origWidth;
+    S->height = height;
+    S->maxSeams = max(maxSeams, 1);
+    S->iterNs = np_zero_array<double>(S->maxSeams);
+    if (!S->iterNs) return SEAMC_freeStats(S);
+    return S;
+}
+
+SEAMC_STATS_t* SEAMC_freeStats(SEAMC_STATS_t *S)
+{
+    if (S) {
+        S->iterNs = np_free_array<double>(S->iterNs);
+        np_free_array<SEAMC_STATS_t>(S);
+    }
+    return NULL;
+}
+
+static int histBin(double ns)
+{
+    int bin = 0;
+    while ((ns >= 2.0) && (bin < SEAMC_HIST_BINS - 1)) {
+        ns *= 0.5;
+        bin++;
+    }
+    return bin;
+}
+
+/* Charges the time since tick to stage and restarts tick, so consecutive
+ ** stages can share one tick.  S may be NULL (just returns the elapsed ns).
+ */
+double SEAMC_tock(SEAMC_STATS_t *S, int stage, SEAMC_TICK_t &tick)
+{
+    SEAMC_TICK_t now = SEAMC_tick();
+    double ns = chrono::duration<double, nano>(now - tick).count();
+    tick = now;
+    if (S) {
+        S->stageNs[stage] += ns;
+        S->stageCalls[stage]++;
+        S->stageHist[stage][histBin(ns)]++;
+    }
+    return ns;
+}
+
+// Records one seam's wall time (S may be NULL), returns it in ns
+double SEAMC_statsIteration(SEAMC_STATS_t *S, SEAMC_TICK_t start)
+{
+    double ns = chrono::duration<double, nano>(SEAMC_tick() - start).count();
+    if (S && (S->numSeams < S->maxSeams)) {
+        S->iterNs[S->numSeams++] = ns;
+        S->totalNs += ns;
+    }
+    return ns;
+}
+
+/* One line per seam, "<height> x <width>: x0 x1 ...", the same as the
+ ** carves files ref_images/carve.py writes so they can be diffed directly.
+ */
+void SEAMC_logSeam(SEAMC_STATS_t *S, const int32_t *CARVE, int width, int height)
+{
+    if (!S || !S->seamLog) return;
+    fprintf(S->seamLog, "%d x %d: ", height, width);
+    for (int y = 0; y < height; y++) {
+        fprintf(S->seamLog, "%d ", CARVE[y]);
+    }
+    fprintf(S->seamLog, "\n");
+}
+
+// Nearest rank percentile of the seam times, in ms
+static double iterPercentile(const SEAMC_STATS_t *S, double pct)
+{
+    if (S->numSeams < 1) return 0.0;
+    double *sorted = np_new_array<double>(S->numSeams);
+    ::memcpy(sorted, S->iterNs, S->numSeams * sizeof(double));
+    sort(sorted, sorted + S->numSeams);
+    int rank = (int) (pct / 100.0 * S->numSeams + 0.5);
+    double ms = sorted[min(max(rank - 1, 0), S->numSeams - 1)] * 1e-6;
+    np_free_array<double>(sorted);
+    return ms;
+}
+
+void SEAMC_writeStats(FILE *out, const SEAMC_STATS_t *S, bool asJSON)
+{
+    const int n = S->numSeams;
+    const double totalSec = S->totalNs * 1e-9;
+    const double avgMs = (n > 0) ? (S->totalNs * 1e-6 / n) : 0.0;
+    double first100Ns = 0.0;
+    for (int i = 0; i < min(n, 100); i++) {
+        first100Ns += S->iterNs[i];
+    }
+    const bool isHalf = (abs(2 * n - S->origWidth) <= 1);
+    
+    if (asJSON) {
+        fprintf(out, "{\n");
+        fprintf(out, "  \"input_image\": \"%s\",\n", S->inputImage);
+        fprintf(out, "  \"cols_removed\": %d,\n", n);
+        fprintf(out, "  \"orig_width\": %d,\n", S->origWidth);
+        fprintf(out, "  \"height\": %d,\n", S->height);
+        fprintf(out, "  \"seamc_total_time_seconds\": %.6f,\n", totalSec);
+        fprintf(out, "  \"seamc_avg_time_per_iteration_milliseconds\": %.6f,\n", avgMs);
+        fprintf(out, "  \"act_100_c\": %.6f,\n", first100Ns * 1e-9);
+        fprintf(out, "  \"avg_ns_row_c\": %.6f,\n", avgMs * 1000.0 / S->origWidth);
+        fprintf(out, "  \"iter_p50_ms\": %.6f,\n", iterPercentile(S, 50.0));
+        fprintf(out, "  \"iter_p95_ms\": %.6f,\n", iterPercentile(S, 95.0));
+        fprintf(out, "  \"stages\": {\n");
+        for (int s = 0; s < SEAMC_NUM_STAGES; s++) {
+            int lastBin = SEAMC_HIST_BINS - 1;
+            while ((lastBin > 0) && (S->stageHist[s][lastBin] == 0)) lastBin--;
+            
+            fprintf(out, "    \"%s\": { \"total_ms\": %.6f, \"calls\": %ld, \"hist_log2_ns\": [",
+                    STAGE_NAMES[s], S->stageNs[s] * 1e-6, S->stageCalls[s]);
+            for (int b = 0; b <= lastBin; b++) {
+                fprintf(out, "%s%ld", (b > 0) ? ", " : "", S->stageHist[s][b]);
+            }
+            fprintf(out, "] }%s\n", (s < SEAMC_NUM_STAGES - 1) ? "," : "");
+        }
+        fprintf(out, "  }\n}\n");
+    } else {
+        fprintf(out, "input_image, cols_removed, seamcl_total_time_seconds, "
+                "seamcl_avg_time_per_iteration_milliseconds, seamc_total_time_seconds, "
+                "seamc_total_time_milliseconds, seamc_avg_time_per_iteration_milliseconds,"
+                "orig_width,actual_half_c,act_100_c,avg_ns_row_c");
+        for (int s = 0; s < SEAMC_NUM_STAGES; s++) {
+            fprintf(out, ",%s_ms", STAGE_NAMES[s]);
+        }
+        fprintf(out, ",iter_p50_ms,iter_p95_ms\n");
+        
+        fprintf(out, "%s,%d,,,%.6f,%.3f,%.6f,%d,", S->inputImage, n, totalSec, totalSec * 1e3, avgMs,
+                S->origWidth);
+        if (isHalf) fprintf(out, "%.6f", totalSec);
+        fprintf(out, ",%.6f,%.6f", first100Ns * 1e-9, avgMs * 1000.0 / S->origWidth);
+        for (int s = 0; s < SEAMC_NUM_STAGES; s++) {
+            fprintf(out, ",%.6f", S->stageNs[s] * 1e-6);
+        }
+        fprintf(out, ",%.6f,%.6f\n", iterPercentile(S, 50.0), iterPercentile(S, 95.0));
+    }
+}
@@ -1,4 +1,7 @@
-__kernel void backtrack_vert(__global float *energyMatrix,
+// Walks the seam up from the min found by find_min_vert. SEAM_STEP (precision prelude) is the
+// shared tie rule, so the path matches SEAMC_backtrackRows and verify::hostSeam exactly.
+// Serial by nature, run as a single work item.
+__kernel void backtrack_vert(__global cost_t *energyMatrix,
                              __global int *vertSeamPath,
                              __global int *startMinIdx,
                              int width,
@@ -6,31 +9,23 @@ __kernel void backtrack_vert(__global float *energyMatrix,
                              int pitch,
                              int colsRemoved) {
 // Index into matrix
-#define rM(M,X,Y) (M)[((Y)*pitch+(X))]
-
-    const int localIdx = get_local_id(0);
-    const int startRowIdx = height - 2;
+#define rM(M,X,Y) COST_LOAD(M, ((Y)*pitch+(X)))
 
+    const int imgEndIdx = width - colsRemoved;
     int curIdx = *startMinIdx;
 
-    if (localIdx == 0) {
-        // We know the first value already
-        vertSeamPath[height - 1] = curIdx;
+    // We know the first value already
+    vertSeamPath[height - 1] = curIdx;
 
-        // Backtrack
-        for (int y = startRowIdx; y >= 0; y--) {
+    // Backtrack
+    for (int y = height - 2; y >= 0; y--) {
 
-            float left = (curIdx < 0) ? MAXFLOAT : rM(energyMatrix, curIdx - 1, y);
-            float center = rM(energyMatrix, curIdx, y);
-            float right = (curIdx > (width-colsRemoved)) ? MAXFLOAT : rM(energyMatrix, curIdx + 1, y);
+        costf_t left = (curIdx < 1) ? COST_MAX : rM(energyMatrix, curIdx - 1, y);
+        costf_t center = rM(energyMatrix, curIdx, y);
+        costf_t right = (curIdx + 1 >= imgEndIdx) ? COST_MAX : rM(energyMatrix, curIdx + 1, y);
 
-            if (left < center) {
-                curIdx += (left < right) ? -1 : 1;
-            } else {
-                curIdx += (center < right) ? 0 : 1;
-            }
+        curIdx += SEAM_STEP(left, center, right);
 
-            vertSeamPath[y] = curIdx;
-        }
+        vertSeamPath[y] = curIdx;
     }
 }
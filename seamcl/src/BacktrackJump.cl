@@ -0,0 +1,87 @@
+// Backtrack in log depth from the parent steps the DP left in parents (see computeSeams.cl),
+// for tall images where backtrack_vert's one walker spends a global read per row.
+//
+// The rows are cut at r_b = min(b * blockRows, height - 1), b = 0 .. numBlocks, and g_b maps a
+// column on row r_{b+1} to where its path crosses row r_b. Then
+//   backtrack_blocks   jumps[b][x] = g_b(x), every column of every block at once
+//   backtrack_jump     log2(numBlocks) pointer jumping passes turn that into the composition
+//                      g_b(g_{b+1}(... g_{numBlocks-1}(x))), i.e. straight to row r_b from row
+//                      height - 1
+//   backtrack_walk     one item per block looks up where the seam enters it and walks its rows
+// The path follows exactly the same steps as backtrack_vert.
+
+// jumps[b * pitch + x] = g_b(x)
+__kernel void backtrack_blocks(__global char *parents,
+                               __global int *jumps,
+                               int width,
+                               int height,
+                               int pitch,
+                               int colsRemoved,
+                               int blockRows,
+                               int numBlocks) {
+    const int x = get_global_id(0);
+    const int b = get_global_id(1);
+    if (x >= width - colsRemoved || b >= numBlocks) {
+        return;
+    }
+
+    const int top = min(b * blockRows, height - 1);
+    const int bottom = min((b + 1) * blockRows, height - 1);
+    int curIdx = x;
+    for (int y = bottom; y > top; --y) {
+        curIdx += parents[y * pitch + curIdx];
+    }
+    jumps[b * pitch + x] = curIdx;
+}
+
+// One pointer jumping pass: out_b = in_b o in_{b+distance}, so after the pass with distance
+// d each block jumps over 2d blocks (or to the bottom row).
+__kernel void backtrack_jump(__global int *inJumps,
+                             __global int *outJumps,
+                             int width,
+                             int pitch,
+                             int colsRemoved,
+                             int numBlocks,
+                             int distance) {
+    const int x = get_global_id(0);
+    const int b = get_global_id(1);
+    if (x >= width - colsRemoved || b >= numBlocks) {
+        return;
+    }
+
+    int curIdx = x;
+    if (b + distance < numBlocks) {
+        curIdx = inJumps[(b + distance) * pitch + curIdx];
+    }
+    outJumps[b * pitch + x] = inJumps[b * pitch + curIdx];
+}
+
+// Block b writes rows r_{b+1} .. r_b + 1 of the seam, block 0 row 0 as well. jumps is the
+// result of the last backtrack_jump pass.
+__kernel void backtrack_walk(__global char *parents,
+                             __global int *jumps,
+                             __global int *vertSeamPath,
+                             __global int *startMinIdx,
+                             int height,
+                             int pitch,
+                             int blockRows,
+                             int numBlocks) {
+    const int b = get_global_id(0);
+    if (b >= numBlocks) {
+        return;
+    }
+
+    const int top = min(b * blockRows, height - 1);
+    const int bottom = min((b + 1) * blockRows, height - 1);
+    int curIdx = *startMinIdx;
+    if (b + 1 < numBlocks) {
+        curIdx = jumps[(b + 1) * pitch + curIdx];
+    }
+    for (int y = bottom; y > top; --y) {
+        vertSeamPath[y] = curIdx;
+        curIdx += parents[y * pitch + curIdx];
+    }
+    if (b == 0) {
+        vertSeamPath[0] = curIdx;
+    }
+}
@@ -1,23 +1,152 @@
-// Carves a vertical seam from the image
+// Carves a vertical seam from the image (and the matrices, all pitch elements a row)
+// Each work item writes only its own dst pixel (gathering from x or x + 1), so no two items touch
+// the same pixel and the result doesn't depend on execution order. Only the live columns are
+// written, no kernel reads past them.
+// The energy, cost and parent matrices are carved the same way when their src isn't NULL, for
+// image_gradient_seam and computeSeamsCone to patch up around the seam.
 __kernel void carve_vert(__global uchar4* srcImg,
                          __global uchar4* dstImg,
                          __global int *vertSeamPath,
+                         __global cost_t *srcEnergy,
+                         __global cost_t *dstEnergy,
+                         __global cost_t *srcCost,
+                         __global cost_t *dstCost,
+                         __global char *srcParents,
+                         __global char *dstParents,
                          int width,
                          int height,
+                         int pitch,
                          int numRowsCarved) {
     int2 myPixel = (int2) (get_global_id(0), get_global_id(1));
 
+    if (myPixel.x < (width - numRowsCarved) && myPixel.y < height) {
+        int carveIdx = vertSeamPath[myPixel.y];
+        int idx = myPixel.y * pitch + myPixel.x;
+        int srcX = (myPixel.x < carveIdx) ? myPixel.x : myPixel.x + 1;
+        int srcIdx = myPixel.y * pitch + srcX;
+        dstImg[idx] = srcImg[srcIdx];
+        if (srcEnergy) {
+            COST_STORE(dstEnergy, idx, COST_LOAD(srcEnergy, srcIdx));
+        }
+        if (srcCost) {
+            COST_STORE(dstCost, idx, COST_LOAD(srcCost, srcIdx));
+        }
+        if (srcParents) {
+            dstParents[idx] = srcParents[srcIdx];
+        }
+    }
+}
 
+// Carves the seam like carve_vert and computes the carved image's Sobel energy in the same pass,
+// so the next seam needs neither image_gradient nor mask_unreachable. Each work group gathers
+// the luminance of its tile of the carved image plus a one pixel halo into lums
+// ((local size x + 2) * (local size y + 2)), writing the tile's own pixels to dstImg on the
+// way, and takes the gradient from there. The halo is clamped like sobel_gradient_at's stencil
+// and the sums are in the same order, so the energy is what image_gradient would give on dstImg.
+// Like carve_vert it only writes the live columns.
+__kernel void carve_vert_gradient(__global uchar4* srcImg,
+                                  __global uchar4* dstImg,
+                                  __global int *vertSeamPath,
+                                  __global cost_t *energyMatrix,
+                                  int width,
+                                  int height,
+                                  int pitch,
+                                  int numRowsCarved,
+                                  __local lum_t *lums) {
+    const int liveWidth = width - numRowsCarved;
+    const int localX = get_local_id(0);
+    const int localY = get_local_id(1);
+    const int tileWidth = get_local_size(0);
+    const int tileHeight = get_local_size(1);
+    const int x0 = get_group_id(0) * tileWidth;
+    const int y0 = get_group_id(1) * tileHeight;
+    const int haloWidth = tileWidth + 2;
+    const int haloSize = haloWidth * (tileHeight + 2);
 
-    if (myPixel.x < width && myPixel.y < height) {
-        int carveIdx = vertSeamPath[myPixel.y];
-        if (myPixel.x < carveIdx) {
-            dstImg[myPixel.y * width + myPixel.x] = srcImg[myPixel.y * width + myPixel.x];
-        } else if (myPixel.x >= carveIdx && myPixel.x < (width - numRowsCarved)) {
-            dstImg[myPixel.y * width + (myPixel.x-1)] = srcImg[myPixel.y * width + myPixel.x];
-        } else {
-            dstImg[myPixel.y * width + myPixel.x] = (uchar4) (0, 0, 0, 0);
+    for (int i = localY * tileWidth + localX; i < haloSize; i += tileWidth * tileHeight) {
+        const int haloX = x0 + i % haloWidth - 1;
+        const int haloY = y0 + i / haloWidth - 1;
+        const int x = clamp(haloX, 0, liveWidth - 1);
+        const int y = clamp(haloY, 0, height - 1);
+        const int srcX = (x < vertSeamPath[y]) ? x : x + 1;
+        const uchar4 pixel = srcImg[y * pitch + srcX];
+        lums[i] = LUM(pixel);
+        // The tile's own live pixels, not the halo or a clamped copy
+        if (x == haloX && y == haloY && x >= x0 && x < x0 + tileWidth &&
+            y >= y0 && y < y0 + tileHeight) {
+            dstImg[y * pitch + x] = pixel;
         }
     }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    const int x = x0 + localX;
+    const int y = y0 + localY;
+    if (x >= liveWidth || y >= height) {
+        return;
+    }
+
+// Luminance of the pixel DX, DY from this one (DY = -1 is sobel_gradient_at's below)
+#define rL(DX,DY) lums[(localY + 1 + (DY)) * haloWidth + localX + 1 + (DX)]
+    const lum_t sobel_gradient =
+        LUM_ABS(rL(1,-1) - rL(-1,-1) + rL(1,1) - rL(-1,1) + 2*(rL(1,0) - rL(-1,0))) +
+        LUM_ABS(rL(-1,1) - rL(-1,-1) + rL(1,1) - rL(1,-1) + 2*(rL(0,1) - rL(0,-1)));
+#undef rL
+    COST_STORE(energyMatrix, y * pitch + x, ENERGY(sobel_gradient));
 }
 
+// Carves the seam out of img in place: one work group per row shifts the pixels right of the
+// seam one to the left, in chunks of the group size. Each chunk is read into registers before
+// the barrier and written after it, so no item overwrites a pixel another has yet to read, and
+// the next chunk only reads pixels this one doesn't write. The carried matrices (NULL for none)
+// shift the same way. The dead columns are left alone.
+__kernel void carve_vert_inplace(__global uchar4* img,
+                                 __global int *vertSeamPath,
+                                 __global cost_t *energy,
+                                 __global cost_t *cost,
+                                 __global char *parents,
+                                 int width,
+                                 int height,
+                                 int pitch,
+                                 int numRowsCarved) {
+    const int y = get_group_id(0);
+    const int localIdx = get_local_id(0);
+    const int localSize = get_local_size(0);
+    if (y >= height) {
+        return;
+    }
+
+    const int liveWidth = width - numRowsCarved;
+    const int row = y * pitch;
+    for (int base = vertSeamPath[y]; base < liveWidth; base += localSize) {
+        const int x = base + localIdx;
+        const bool live = (x < liveWidth);
+        uchar4 pixel = (uchar4) (0, 0, 0, 0);
+        costf_t energyValue = 0, costValue = 0;
+        char parent = 0;
+        if (live) {
+            pixel = img[row + x + 1];
+            if (energy) {
+                energyValue = COST_LOAD(energy, row + x + 1);
+            }
+            if (cost) {
+                costValue = COST_LOAD(cost, row + x + 1);
+            }
+            if (parents) {
+                parent = parents[row + x + 1];
+            }
+        }
+        barrier(CLK_GLOBAL_MEM_FENCE);
+        if (live) {
+            img[row + x] = pixel;
+            if (energy) {
+                COST_STORE(energy, row + x, energyValue);
+            }
+            if (cost) {
+                COST_STORE(cost, row + x, costValue);
+            }
+            if (parents) {
+                parents[row + x] = parent;
+            }
+        }
+    }
+}
@@ -1,42 +1,85 @@
-// Does Dynamic Programming with Trapezoid blocking
-// Trapezoid height and width (at top) need to be specified.
-
-__kernel void DP_trapezoid(
-    __global float* ioMatrix, // Gradient IN and PixelCost OUT (in-place)
-    int width,      // costMatrix width (matches image width)
-    int height,     //   ...and height.
-    int pitch       // Distance to advance a pointer into matrix for each row (or col)
-    int colsRemoved // number of seams already carved.
-    int trapz_height // The height of trapezoid.
-) {
+// Does Dynamic Programming with Trapezoid blocking, so the DP can use every compute unit.
+//
+// The live columns are split into tiles of tileWidth, and the rows into bands of bandRows (at
+// most tileWidth / 2). Each band takes two launches, one work group per tile:
+//   phase 0: each tile fills an upright trapezoid, [x0 + k, x1 - k) on the band's k-th row.
+//            It only needs the row above inside its own tile, so the groups are independent.
+//            The tiles at the image edges don't shrink on the edge side (the stencil clamps).
+//   phase 1: each tile fills the inverted trapezoid between itself and the next tile,
+//            [x1 - k, x1 + k), from the row above that phase 0 or phase 1 already finished.
+// The launch boundaries are the only global syncs, rows within a group are ordered by the
+// barrier. Every cell is the same COST_ADD of the same three parents as in computeSeams.cl, so
+// the costs (and the seams) are identical. parents is as in computeSeams.cl.
+// Each cell of the last row belongs to one tile in one phase, so on the last band (outMin not
+// NULL) every group leaves the min of its part of that row at outMin[phase * groups + group],
+// for find_min_partials to take the least of.
+__kernel void DP_trapezoid(__global cost_t *energyMatrix,
+                           __global cost_t *ioMatrix,
+                           __global char *parents,
+                           int width,
+                           int height,
+                           int pitch,
+                           int colsRemoved,
+                           int bandStart,
+                           int bandRows,
+                           int tileWidth,
+                           int phase,
+                           __global costf_t *outMin,
+                           __global int *outMinIdx,
+                           __local costf_t *minMem,
+                           __local int *minIdxMem) {
 
 // Index into matrix
-#define rM(M,X,Y) (M)[((Y)*pitch+(X))]
-    const int imgWidth = width - colsRemoved;
+#define rM(M,X,Y) COST_LOAD(M, ((Y)*pitch+(X)))
+    const int imgEndIdx = width - colsRemoved;
     const int localIdx = get_local_id(0);
     const int localSize = get_local_size(0);
-    const int blockSize = imgWidth / localSize;
-    const int startX = localIdx * blockSize; // left top x-coor of trapezoid.
-    const int endX = (localIdx == localSize - 1) ? imgEndIdx : startX + blockSize; // right top x-coor of trapezoid.
-    // width of current level of the trapezoid.
-    for (int y_block = 1; y_block < height; y_block+=trapz_height) {
+    const int x0 = get_group_id(0) * tileWidth;
+    const int x1 = min(x0 + tileWidth, imgEndIdx);
+    const int rows = min(bandRows, height - bandStart);
+    const int partial = phase * get_num_groups(0) + get_group_id(0);
+
+    if (phase == 1 && x1 >= imgEndIdx) {
+        // No tile to the right, nothing between
+        if (outMin && localIdx == 0) {
+            outMin[partial] = COST_MAX;
+            outMinIdx[partial] = imgEndIdx;
+        }
+        return;
+    }
+
+    int lo = 0, hi = 0;
+    for (int k = 0; k < rows; ++k) {
+        const int y = bandStart + k;
+        if (phase == 0) {
+            lo = (x0 == 0) ? 0 : x0 + k;
+            hi = (x1 == imgEndIdx) ? imgEndIdx : x1 - k;
+        } else {
+            lo = x1 - k;
+            hi = min(x1 + k, imgEndIdx);
+        }
+        for (int x = lo + localIdx; x < hi; x += localSize) {
+            const costf_t left = rM(ioMatrix, max(x-1, 0), y - 1);
+            const costf_t center = rM(ioMatrix, x, y - 1);
+            const costf_t right = rM(ioMatrix, min(x+1, imgEndIdx - 1), y - 1);
+            COST_STORE(ioMatrix, y * pitch + x, COST_ADD(rM(energyMatrix, x, y), min(left, min(center, right))));
+            if (parents) {
+                parents[y * pitch + x] = SEAM_STEP(left, center, right);
+            }
+        }
+        barrier(CLK_GLOBAL_MEM_FENCE);
+    }
 
-      // a new trapezoid:
-      int trap_x_start = max(startX - trapz_height + 1, 0);
-      // left border of this row of the trapezoid.
-      int trap_x_end = min(endX + trapz_height - 1, imgWidth);
-      // right border of this trapezoid row.
-	for (int y = y_block; y < y_block + trapz_height;++y) {
-	  for (int x = trap_x_start; x < trap_x_end; ++x) {
-	    const float pathCost = fmin(rM(ioMatrix, max(x-1, 0),     y - 1),
-                                   fmin(rM(ioMatrix,           x,     y - 1),
-                                        rM(ioMatrix, min(x+1, imgEndIdx), y - 1)));
-            rM(ioMatrix, x, y) += pathCost;
-	    }
+    if (outMin) {
+        // [lo, hi) is what this group filled of the last row, read back as stored
+        costf_t lastMin = COST_MAX;
+        int lastMinIdx = 0;
+        scan_min(ioMatrix, height - 1, pitch, lo, hi, &lastMin, &lastMinIdx);
+        reduce_min(lastMin, lastMinIdx, minMem, minIdxMem);
+        if (localIdx == 0) {
+            outMin[partial] = minMem[0];
+            outMinIdx[partial] = minIdxMem[0];
         }
-        // next level of trapezoid is skinnier:
-	trapezoid_x_start++;
-	trapezoid_x_end--; 
-	barrier(CLK_GLOBAL_MEM_FENCE);
     }
+#undef rM
 }
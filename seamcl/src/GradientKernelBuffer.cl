@@ -1,43 +1,87 @@
 // Computes Sobel convolution of srcImage, writing result to resultMatrix:
+// (cost_t and ENERGY come from the precision prelude)
+// Both are pitch elements a row.
+// Pixels are BGRA (FreeImage's byte order), so red is .z and blue is .x.
+
+// Sobel gradient of one pixel, the stencil clamped to the live image
+lum_t sobel_gradient_at(__global uchar4* srcImg,
+                        int x,
+                        int y,
+                        int width,
+                        int height,
+                        int pitch,
+                        int colsRemoved)
+{
+     int x_left = max(x-1,0);
+     int x_right = min(x+1,width-colsRemoved-1);
+     int y_below = max(y-1,0);
+     int y_above = min(y+1,height-1);
+
+         // get luminescence values for pixels:
+       uchar4 belowLeftPixel = srcImg[y_below * pitch + x_left];
+         uchar4 belowPixel = srcImg[y_below * pitch + x];
+         uchar4 belowRightPixel = srcImg[y_below * pitch + x_right];
+         uchar4 leftPixel = srcImg[y * pitch + x_left];
+         uchar4 rightPixel = srcImg[y * pitch + x_right];
+         uchar4 aboveLeftPixel = srcImg[y_above * pitch + x_left];
+         uchar4 abovePixel =  srcImg[y_above * pitch + x];
+         uchar4 aboveRightPixel = srcImg[y_above * pitch + x_right];
+
+   // get luminance values (LUM and lum_t come from the precision prelude):
+         lum_t belowLeftLum = LUM(belowLeftPixel);
+         lum_t belowLum = LUM(belowPixel);
+         lum_t belowRightLum = LUM(belowRightPixel);
+         lum_t leftLum = LUM(leftPixel);
+         lum_t rightLum = LUM(rightPixel);
+         lum_t aboveLeftLum = LUM(aboveLeftPixel);
+         lum_t aboveLum = LUM(abovePixel);
+         lum_t aboveRightLum = LUM(aboveRightPixel);
+         //float gradient = fabs(rightLum - leftLum) + fabs(aboveLum - belowLum);
+
+return LUM_ABS(belowRightLum - belowLeftLum + aboveRightLum - aboveLeftLum + 2*(rightLum - leftLum)) + LUM_ABS(aboveLeftLum - belowLeftLum + aboveRightLum - belowRightLum + 2*(aboveLum - belowLum));
+}
 
 __kernel void image_gradient(__global uchar4* srcImg,
-                             __global float* resultMatrix,
+                             __global cost_t* resultMatrix,
                              int width,
                              int height,
+                             int pitch,
                              int colsRemoved)
 {
      // Determine what portion of image to operate on:
      int x = get_global_id(0);
      int y = get_global_id(1);
-     int x_left = max(x-1,0);
-     int x_right = min(x+1,height-1);
-     int y_below = max(y-1,0);
-     int y_above = min(y+1,height-1);
 
-       if (x < width && y < height) {
-         // get luminescence values for pixels:
-       uchar4 belowLeftPixel = srcImg[y_below * width + x_left];
-         uchar4 belowPixel = srcImg[y_below * width + x];
-         uchar4 belowRightPixel = srcImg[y_below * width + x_right];
-         uchar4 leftPixel = srcImg[y * width + x_left];
-         uchar4 rightPixel = srcImg[y * width + x_right];
-         uchar4 aboveLeftPixel = srcImg[y_above * width + x_left];
-         uchar4 abovePixel =  srcImg[y_above * width + x];
-         uchar4 aboveRightPixel = srcImg[y_above * width + x_right];
-
-   // get luminance values:
-         float belowLeftLum = (float)belowLeftPixel.x * 0.299f + (float)belowLeftPixel.y * 0.587f + (float)belowLeftPixel.z * 0.114f;
-         float belowLum = (float)belowPixel.x * 0.299f + (float)belowPixel.y * 0.587f + (float)abovePixel.z * 0.114f;
-         float belowRightLum = (float)belowRightPixel.x * 0.299f + (float)belowRightPixel.y * 0.587f + (float)belowRightPixel.z * 0.114f;
-         float leftLum = (float)leftPixel.x * 0.299f + (float)leftPixel.y * 0.587f + (float)leftPixel.z * 0.114f;
-         float rightLum = (float)rightPixel.x * 0.299f + (float)rightPixel.y * 0.587f + (float)rightPixel.z * 0.114f;
-         float aboveLeftLum = (float)aboveLeftPixel.x * 0.299f + (float)aboveLeftPixel.y * 0.587f + (float)aboveLeftPixel.z * 0.114f;
-         float aboveLum = (float)abovePixel.x * 0.299f + (float)abovePixel.y * 0.587f + (float)abovePixel.z * 0.114f;
-         float aboveRightLum = (float)aboveRightPixel.x * 0.299f + (float)aboveRightPixel.y * 0.587f + (float)aboveRightPixel.z * 0.114f;
-         //float gradient = fabs(rightLum - leftLum) + fabs(aboveLum - belowLum);
+       if (x < width - colsRemoved && y < height) {
+         lum_t sobel_gradient = sobel_gradient_at(srcImg, x, y, width, height, pitch, colsRemoved);
+         COST_STORE(resultMatrix, x + pitch * y, ENERGY(sobel_gradient));
+    }
+}
 
-float sobel_gradient = fabs(belowRightLum - belowLeftLum + aboveRightLum - aboveLeftLum + 2*(rightLum - leftLum)) + fabs(aboveLeftLum - belowLeftLum + aboveRightLum - belowRightLum + 2*(aboveLum - belowLum));
+// Brings the energy up to date after carve_vert removed seamPath and shifted the old energy
+// along with the pixels. Only pixels whose 3x3 stencil straddles the seam changed: on row y
+// those are columns min(seam y-1 .. y+1) - 2 to max(seam y-1 .. y+1) + 1, at most six, so this
+// runs as a few items per row. colsRemoved already counts the removed seam.
+__kernel void image_gradient_seam(__global uchar4* srcImg,
+                                  __global cost_t* resultMatrix,
+                                  __global int* seamPath,
+                                  int width,
+                                  int height,
+                                  int pitch,
+                                  int colsRemoved)
+{
+     int y = get_global_id(1);
+     if (y >= height) {
+         return;
+     }
+     int seamAbove = seamPath[max(y-1,0)];
+     int seam = seamPath[y];
+     int seamBelow = seamPath[min(y+1,height-1)];
+     int lo = max(min(seamAbove, min(seam, seamBelow)) - 2, 0);
+     int hi = min(max(seamAbove, max(seam, seamBelow)) + 1, width - colsRemoved - 1);
 
-         resultMatrix[x + width * y] = sobel_gradient;
-    }
+     for (int x = lo + get_global_id(0); x <= hi; x += get_global_size(0)) {
+         lum_t sobel_gradient = sobel_gradient_at(srcImg, x, y, width, height, pitch, colsRemoved);
+         COST_STORE(resultMatrix, x + pitch * y, ENERGY(sobel_gradient));
+     }
 }
@@ -1,12 +1,24 @@
-// Computes cost to reach each pixel from top.
-__kernel void computeSeams(__global float *ioMatrix,
+// Computes cost to reach each pixel from top, into ioMatrix (whose first row must already hold
+// the energy) from the energy in energyMatrix, which can be ioMatrix itself. If parents isn't
+// NULL it also gets each cell's SEAM_STEP to its parent on the row above, for backtrack_blocks
+// (BacktrackJump.cl); the DP's clamped edges give the same step as backtrack_vert's COST_MAX
+// ones. If outMin isn't NULL the last row's min and its column go there too, as find_min_vert
+// would find them, so the seam doesn't need a launch of its own for that (minMem and minIdxMem
+// are a slot per work item).
+__kernel void computeSeams(__global cost_t *energyMatrix,
+                           __global cost_t *ioMatrix,
+                           __global char *parents,
                            int width,
                            int height,
                            int pitch,
-                           int colsRemoved) {
+                           int colsRemoved,
+                           __global costf_t *outMin,
+                           __global int *outMinIdx,
+                           __local costf_t *minMem,
+                           __local int *minIdxMem) {
 
 // Index into matrix
-#define rM(M,X,Y) (M)[((Y)*pitch+(X))]
+#define rM(M,X,Y) COST_LOAD(M, ((Y)*pitch+(X)))
     const int imgEndIdx = width - colsRemoved;
     const int localIdx = get_local_id(0);
     const int localSize = get_local_size(0);
@@ -16,12 +28,208 @@ __kernel void computeSeams(__global float *ioMatrix,
 
     for (int y = 1; y < height; ++y) {
         for (int x = startX; x < endX; ++x) {
-            const float pathCost = fmin(rM(ioMatrix, max(x-1, 0),     y - 1),
-                                   fmin(rM(ioMatrix,           x,     y - 1),
-                                        rM(ioMatrix, min(x+1, imgEndIdx), y - 1)));
-            rM(ioMatrix, x, y) += pathCost;
+            const costf_t left = rM(ioMatrix, max(x-1, 0), y - 1);
+            const costf_t center = rM(ioMatrix, x, y - 1);
+            const costf_t right = rM(ioMatrix, min(x+1, imgEndIdx - 1), y - 1);
+            COST_STORE(ioMatrix, y * pitch + x, COST_ADD(rM(energyMatrix, x, y), min(left, min(center, right))));
+            if (parents) {
+                parents[y * pitch + x] = SEAM_STEP(left, center, right);
+            }
         }
         barrier(CLK_GLOBAL_MEM_FENCE);
     }
 
+    if (outMin) {
+        // Read back, so the min is of the costs as stored (not the floats half precision
+        // computes them in)
+        costf_t lastMin = COST_MAX;
+        int lastMinIdx = 0;
+        barrier(CLK_GLOBAL_MEM_FENCE);
+        scan_min(ioMatrix, height - 1, pitch, 0, imgEndIdx, &lastMin, &lastMinIdx);
+        reduce_min(lastMin, lastMinIdx, minMem, minIdxMem);
+        if (localIdx == 0) {
+            *outMin = minMem[0];
+            *outMinIdx = minIdxMem[0];
+        }
+    }
+}
+
+// Same DP, but adjacent work items take adjacent columns (so the row loads and stores coalesce)
+// and the previous row is read from a __local copy, so rows only need a local barrier. rows is
+// two rows of the live width, swapped every row. Where the driver has relative sub-group
+// shuffles, the left and right parents come from the neighbouring work items instead. outMin
+// as in computeSeams.
+#if defined(cl_khr_subgroup_shuffle_relative)
+#pragma OPENCL EXTENSION cl_khr_subgroup_shuffle_relative : enable
+#endif
+__kernel void computeSeamsLocal(__global cost_t *energyMatrix,
+                                __global cost_t *ioMatrix,
+                                __global char *parents,
+                                int width,
+                                int height,
+                                int pitch,
+                                int colsRemoved,
+                                __local cost_t *rows,
+                                __global costf_t *outMin,
+                                __global int *outMinIdx,
+                                __local costf_t *minMem,
+                                __local int *minIdxMem) {
+
+#define rM(M,X,Y) COST_LOAD(M, ((Y)*pitch+(X)))
+    const int imgEndIdx = width - colsRemoved;
+    const int localIdx = get_local_id(0);
+    const int localSize = get_local_size(0);
+    __local cost_t *prev = rows;
+    __local cost_t *cur = rows + imgEndIdx;
+
+    for (int x = localIdx; x < imgEndIdx; x += localSize) {
+        COST_STORE(prev, x, rM(ioMatrix, x, 0));
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for (int y = 1; y < height; ++y) {
+#if defined(cl_khr_subgroup_shuffle_relative)
+        // Every item goes round the loop the same number of times, the shuffles need the whole
+        // sub-group
+        const uint lane = get_sub_group_local_id();
+        const uint lanes = get_sub_group_size();
+        for (int base = 0; base < imgEndIdx; base += localSize) {
+            const int x = base + localIdx;
+            const costf_t centre = (x < imgEndIdx) ? COST_LOAD(prev, x) : 0;
+            const costf_t fromLeft = sub_group_shuffle_up(centre, 1);
+            const costf_t fromRight = sub_group_shuffle_down(centre, 1);
+            if (x < imgEndIdx) {
+                const costf_t left = (lane > 0) ? fromLeft : COST_LOAD(prev, max(x-1, 0));
+                const costf_t right = (lane + 1 < lanes && x + 1 < imgEndIdx) ?
+                                      fromRight : COST_LOAD(prev, min(x+1, imgEndIdx - 1));
+                const costf_t cost = COST_ADD(rM(energyMatrix, x, y), min(left, min(centre, right)));
+                COST_STORE(cur, x, cost);
+                COST_STORE(ioMatrix, y * pitch + x, cost);
+                if (parents) {
+                    parents[y * pitch + x] = SEAM_STEP(left, centre, right);
+                }
+            }
+        }
+#else
+        for (int x = localIdx; x < imgEndIdx; x += localSize) {
+            const costf_t left = COST_LOAD(prev, max(x-1, 0));
+            const costf_t centre = COST_LOAD(prev, x);
+            const costf_t right = COST_LOAD(prev, min(x+1, imgEndIdx - 1));
+            const costf_t cost = COST_ADD(rM(energyMatrix, x, y), min(left, min(centre, right)));
+            COST_STORE(cur, x, cost);
+            COST_STORE(ioMatrix, y * pitch + x, cost);
+            if (parents) {
+                parents[y * pitch + x] = SEAM_STEP(left, centre, right);
+            }
+        }
+#endif
+        barrier(CLK_LOCAL_MEM_FENCE);
+        __local cost_t *t = prev;
+        prev = cur;
+        cur = t;
+    }
+
+    if (outMin) {
+        // Read back, so the min is of the costs as stored (not the floats half precision
+        // computes them in)
+        costf_t lastMin = COST_MAX;
+        int lastMinIdx = 0;
+        barrier(CLK_GLOBAL_MEM_FENCE);
+        scan_min(ioMatrix, height - 1, pitch, 0, imgEndIdx, &lastMin, &lastMinIdx);
+        reduce_min(lastMin, lastMinIdx, minMem, minIdxMem);
+        if (localIdx == 0) {
+            *outMin = minMem[0];
+            *outMinIdx = minIdxMem[0];
+        }
+    }
+#undef rM
+}
+
+// Brings last seam's costs up to date instead of redoing the DP. carve_vert carved the old
+// costs (and parents) along with the image, so they are right except where the energy changed
+// (around the seam, the same columns image_gradient_seam recomputed) and below any cell that
+// changed, widening by a column a side per row. Each row recomputes the energy window plus
+// the changed columns of the row above, one either side, and only what really changed widens
+// the next row, so the cone stops as soon as a row comes out the same.
+// seamPath is the seam that was carved, colsRemoved counts it. outMin as in computeSeams, over
+// the whole last row, most of which the cone didn't touch.
+__kernel void computeSeamsCone(__global cost_t *energyMatrix,
+                               __global cost_t *ioMatrix,
+                               __global char *parents,
+                               __global int *seamPath,
+                               int width,
+                               int height,
+                               int pitch,
+                               int colsRemoved,
+                               __global costf_t *outMin,
+                               __global int *outMinIdx,
+                               __local costf_t *minMem,
+                               __local int *minIdxMem) {
+
+#define rM(M,X,Y) COST_LOAD(M, ((Y)*pitch+(X)))
+    const int imgEndIdx = width - colsRemoved;
+    const int localIdx = get_local_id(0);
+    const int localSize = get_local_size(0);
+    // Changed columns of each row, two slots so the next row's can be reset while this row's
+    // are read
+    __local int changedLo[2], changedHi[2];
+
+    int aboveLo = imgEndIdx, aboveHi = -1;
+    for (int y = 0; y < height; ++y) {
+        const int slot = y & 1;
+        if (localIdx == 0) {
+            changedLo[slot] = imgEndIdx;
+            changedHi[slot] = -1;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        const int seamAbove = seamPath[max(y-1, 0)];
+        const int seam = seamPath[y];
+        const int seamBelow = seamPath[min(y+1, height-1)];
+        int lo = min(seamAbove, min(seam, seamBelow)) - 2;
+        int hi = max(seamAbove, max(seam, seamBelow)) + 1;
+        if (aboveHi >= 0) {
+            lo = min(lo, aboveLo - 1);
+            hi = max(hi, aboveHi + 1);
+        }
+        lo = max(lo, 0);
+        hi = min(hi, imgEndIdx - 1);
+
+        for (int x = lo + localIdx; x <= hi; x += localSize) {
+            const int i = y * pitch + x;
+            const costf_t old = COST_LOAD(ioMatrix, i);
+            if (y == 0) {
+                COST_STORE(ioMatrix, i, rM(energyMatrix, x, 0));
+            } else {
+                const costf_t left = rM(ioMatrix, max(x-1, 0), y - 1);
+                const costf_t center = rM(ioMatrix, x, y - 1);
+                const costf_t right = rM(ioMatrix, min(x+1, imgEndIdx - 1), y - 1);
+                COST_STORE(ioMatrix, i, COST_ADD(rM(energyMatrix, x, y), min(left, min(center, right))));
+                if (parents) {
+                    parents[i] = SEAM_STEP(left, center, right);
+                }
+            }
+            // Compared as stored, so a reduced precision rounding to the old value counts as
+            // unchanged
+            if (COST_LOAD(ioMatrix, i) != old) {
+                atomic_min(&changedLo[slot], x);
+                atomic_max(&changedHi[slot], x);
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE | CLK_GLOBAL_MEM_FENCE);
+        aboveLo = changedLo[slot];
+        aboveHi = changedHi[slot];
+    }
+
+    if (outMin) {
+        costf_t lastMin = COST_MAX;
+        int lastMinIdx = 0;
+        scan_min(ioMatrix, height - 1, pitch, 0, imgEndIdx, &lastMin, &lastMinIdx);
+        reduce_min(lastMin, lastMinIdx, minMem, minIdxMem);
+        if (localIdx == 0) {
+            *outMin = minMem[0];
+            *outMinIdx = minIdxMem[0];
+        }
+    }
+#undef rM
 }
@@ -1,54 +1,111 @@
-// This only works with one workgroup! If this is the slowest part, we can separate out the reduction
-// later.
-__kernel void find_min_vert(__global float *energyMatrix,
-                            __global float *outMin,
+// Ties go to the leftmost column (each item scans left to right with a strict <, and the
+// reduction keeps the lower index on equal energy), so the result doesn't depend on scheduling.
+
+// Folds columns [from, to) of row y of M, the ones this work item takes (from + localIdx,
+// from + localIdx + localSize, ...), into min and minIdx.
+void scan_min(__global cost_t *M,
+              int y,
+              int pitch,
+              int from,
+              int to,
+              costf_t *min,
+              int *minIdx) {
+    for (int curIdx = from + get_local_id(0); curIdx < to; curIdx += get_local_size(0)) {
+        costf_t curEnergy = COST_LOAD(M, y * pitch + curIdx);
+
+        if (curEnergy < *min) {
+            *min = curEnergy;
+            *minIdx = curIdx;
+        }
+    }
+}
+
+// Leaves the least of the work group's (min, minIdx) pairs, lower index on equal energy, in
+// reductionMemEnergy[0] and reductionMemIdx[0] (a slot per work item). Every item of the group
+// has to call it; the group can be any size.
+void reduce_min(costf_t min,
+                int minIdx,
+                __local costf_t *reductionMemEnergy,
+                __local int *reductionMemIdx) {
+    const int localIdx = get_local_id(0);
+    const int localSize = get_local_size(0);
+
+    reductionMemIdx[localIdx] = minIdx;
+    reductionMemEnergy[localIdx] = min;
+
+    int span = 1;
+    while (span < localSize) {
+        span <<= 1;
+    }
+
+    // Local memory reduction
+    for (int reductionIdx = span/2; reductionIdx > 0; reductionIdx >>=1) {
+        barrier(CLK_LOCAL_MEM_FENCE);
+        if (localIdx < reductionIdx && localIdx + reductionIdx < localSize) {
+
+            costf_t myEnergy = reductionMemEnergy[localIdx];
+            costf_t reduceEnergy = reductionMemEnergy[localIdx + reductionIdx];
+            int myIdx = reductionMemIdx[localIdx];
+            int reduceIdx = reductionMemIdx[localIdx + reductionIdx];
+            if (reduceEnergy < myEnergy || (reduceEnergy == myEnergy && reduceIdx < myIdx)) {
+                reductionMemEnergy[localIdx] = reduceEnergy;
+                reductionMemIdx[localIdx] = reduceIdx;
+            }
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+// This only works with one workgroup! The DP kernels can do this as they finish (see
+// computeSeams.cl), this is for when they don't.
+__kernel void find_min_vert(__global cost_t *energyMatrix,
+                            __global costf_t *outMin,
                             __global int *outMinIdx,
-                            __local float *reductionMemIdx,
-                            __local float *reductionMemEnergy,
+                            __local int *reductionMemIdx,
+                            __local costf_t *reductionMemEnergy,
                             int width,
                             int height,
                             int pitch,
                             int colsRemoved) {
-// Index into matrix
-#define rM(M,X,Y) (M)[((Y)*pitch+(X))]
 
-    const int localIdx = get_local_id(0);
-    const int localSize = get_local_size(0);
-
-    const int lastRowIdx = height - 1;
     int energyMinIdx = 0;
-    float energyMin = MAXFLOAT;
+    costf_t energyMin = COST_MAX;
 
     // Find local min
-    for (int curIdx = localIdx; curIdx < (width-colsRemoved); curIdx+= localSize) {
-        float curEnergy = rM(energyMatrix, curIdx, lastRowIdx);
+    scan_min(energyMatrix, height - 1, pitch, 0, width - colsRemoved, &energyMin, &energyMinIdx);
+    reduce_min(energyMin, energyMinIdx, reductionMemEnergy, reductionMemIdx);
 
-        if (curEnergy < energyMin) {
-            energyMin = curEnergy;
-            energyMinIdx = curIdx;
-        }
+    if (get_local_id(0) == 0) {
+        *outMin = reductionMemEnergy[0];
+        *outMinIdx = reductionMemIdx[0];
     }
 
-    reductionMemIdx[localIdx] = energyMinIdx;
-    reductionMemEnergy[localIdx] = energyMin;
+}
 
-    // Local memory reduction
-    for (uint reductionIdx = localSize/2; reductionIdx > 0; reductionIdx >>=1) {
-        barrier(CLK_LOCAL_MEM_FENCE);
-        if (localIdx < reductionIdx) {
+// Second stage for DP_trapezoid, which leaves a min per work group: the least of the
+// numPartials partial minima (not in column order, so ties are settled by index). One work
+// group.
+__kernel void find_min_partials(__global costf_t *partialMin,
+                                __global int *partialIdx,
+                                int numPartials,
+                                __global costf_t *outMin,
+                                __global int *outMinIdx,
+                                __local int *reductionMemIdx,
+                                __local costf_t *reductionMemEnergy) {
 
-            float myEnergy = reductionMemEnergy[localIdx];
-            float reduceEnergy = reductionMemEnergy[localIdx + reductionIdx];
-            if (reduceEnergy < myEnergy) {
-                reductionMemEnergy[localIdx] = reduceEnergy;
-                reductionMemIdx[localIdx] = reductionMemIdx[localIdx + reductionIdx];
-            }
+    int energyMinIdx = INT_MAX;
+    costf_t energyMin = COST_MAX;
+
+    for (int i = get_local_id(0); i < numPartials; i += get_local_size(0)) {
+        if (partialMin[i] < energyMin || (partialMin[i] == energyMin && partialIdx[i] < energyMinIdx)) {
+            energyMin = partialMin[i];
+            energyMinIdx = partialIdx[i];
         }
     }
+    reduce_min(energyMin, energyMinIdx, reductionMemEnergy, reductionMemIdx);
 
-    if (localIdx == 0) {
+    if (get_local_id(0) == 0) {
         *outMin = reductionMemEnergy[0];
         *outMinIdx = reductionMemIdx[0];
     }
-
 }
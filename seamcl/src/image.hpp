@@ -1,12 +1,38 @@
 #ifndef IMAGE_HPP
 #define IMAGE_HPP
 
+// STL
+#include <vector>
+
 #include "mem.hpp"
 
 // Functions relating to image handling
 namespace image {
 
 
+    /**
+     * Reads just the dimensions of an image, without decoding the pixels where FreeImage allows
+     * it, so the kernels (whose prelude depends on the height) can compile during the decode.
+     * @param fileName The image file to use.
+     * @param height An int ref to read the height into.
+     * @param width An int ref to read the width into.
+     */
+    void size(std::string fileName, int &height, int &width) {
+        FREE_IMAGE_FORMAT format = FreeImage_GetFileType(fileName.c_str(), 0);
+#ifdef FIF_LOAD_NOPIXELS
+        FIBITMAP *image = FreeImage_Load(format, fileName.c_str(), FIF_LOAD_NOPIXELS);
+#else
+        FIBITMAP *image = FreeImage_Load(format, fileName.c_str());
+#endif
+        if (!image) {
+            std::cerr << "Error loading image: " << fileName << std::endl;
+            exit(-1);
+        }
+        width = FreeImage_GetWidth(image);
+        height = FreeImage_GetHeight(image);
+        FreeImage_Unload(image);
+    }
+
     /**
      * Loads an image from a file into device texture memory.
 n     * @param ctx An openCL context object.
@@ -23,9 +49,10 @@ n     * @param ctx An openCL context object.
         width = FreeImage_GetWidth(image);
         height = FreeImage_GetHeight(image);
 
-        char buffer[width * height * 4];
+        // Heap, not stack: a VLA this size blows the stack on big images
+        std::vector<char> buffer((size_t) width * height * 4);
 
-        memcpy(buffer, FreeImage_GetBits(image), width * height * 4);
+        memcpy(&buffer[0], FreeImage_GetBits(image), buffer.size());
 
         FreeImage_Unload(image);
 
@@ -38,7 +65,7 @@ n     * @param ctx An openCL context object.
                                        width,
                                        height,
                                        0,
-                                       buffer,
+                                       &buffer[0],
                                        &errNum);
 
         if (errNum != CL_SUCCESS) {
@@ -49,12 +76,17 @@ n     * @param ctx An openCL context object.
         return img;
     }
 
+    /**
+     * Loads an image from a file into a buffer of BGRA pixels, pitch pixels a row (see
+     * mem::pitch(), from the width size() read). It's decoded straight into the mapped buffer,
+     * so there's no host copy to upload.
+     */
     cl::Buffer loadBuffer(cl::Context &ctx,
                           cl::CommandQueue &cmdQueue,
                           std::string fileName,
                           int &height,
                           int &width,
-                          char *& img) {
+                          int pitch) {
 
         FREE_IMAGE_FORMAT format = FreeImage_GetFileType(fileName.c_str(), 0);
         FIBITMAP *image = FreeImage_Load(format, fileName.c_str());
@@ -63,15 +95,14 @@ n     * @param ctx An openCL context object.
         width = FreeImage_GetWidth(image);
         height = FreeImage_GetHeight(image);
 
-        //char img[width * height * 4];
-        img = new char[width * height * 4];
-        memcpy(img, FreeImage_GetBits(image), width * height * 4);
+        cl::Buffer buff = mem::buffer(ctx, cmdQueue, height * pitch * 4);
+        char *img = mem::map(cmdQueue, buff, CL_MAP_WRITE, (size_t) height * pitch * 4);
+        // FreeImage stores rows bottom up, flip so row 0 is the top like seamc and carve.py
+        FreeImage_ConvertToRawBits((BYTE*)img, image, pitch * 4, 32,
+                                   FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, TRUE);
+        mem::unmap(cmdQueue, buff, img);
 
         FreeImage_Unload(image);
-
-        //cl::Buffer buff = mem::buffer(ctx, cmdQueue, width * height * 4);
-        //mem::write(ctx, cmdQueue, img, buff, width * height);
-        cl::Buffer buff = mem::bufferFromHostArray(ctx, cmdQueue, img, width * height * 4);
         return buff;
     }
 
@@ -86,7 +117,7 @@ n     * @param ctx An openCL context object.
      */
     void save(cl::CommandQueue &cmdQueue, cl::Image2D &image, std::string fileName, int height, int width) {
         cl_int errNum;
-        char buffer[width * height * 4];
+        std::vector<char> buffer((size_t) width * height * 4);
         cl::size_t<3> origin;
         origin.push_back(0);
         origin.push_back(0);
@@ -102,7 +133,7 @@ n     * @param ctx An openCL context object.
                                            region,
                                            0, // row pitch is 0
                                            0, // slice pitch is 0
-                                           buffer,
+                                           &buffer[0],
                                            NULL, // no events
                                            NULL);
 
@@ -112,7 +143,7 @@ n     * @param ctx An openCL context object.
         }
 
         FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(fileName.c_str());
-        FIBITMAP *bitmap = FreeImage_ConvertFromRawBits((BYTE*)buffer,
+        FIBITMAP *bitmap = FreeImage_ConvertFromRawBits((BYTE*)&buffer[0],
                                                        width,
                                                        height,
                                                        width * 4,
@@ -128,35 +159,44 @@ n     * @param ctx An openCL context object.
 
     }
 
+    /**
+     * Saves the first width columns of an image buffer, pitch pixels a row, to disk: the live
+     * part of a carved image, without the dead columns past it. Where the device shares memory
+     * with the host they're copied out of the mapped buffer; otherwise mapping would move every
+     * column of the pitch, so just the live ones are read back with a rect read.
+     */
     void saveBuffer(cl::Context &ctx,
                     cl::CommandQueue &cmdQueue,
                     cl::Buffer &image,
                     std::string fileName,
                     int height,
                     int width,
-                    char *&buffer) {
-
-        size_t imgNumBytes = width * height * 4;
-        buffer = new char[imgNumBytes];
-        //char buffer[width * height * 4];
-        mem::read(ctx, cmdQueue, buffer, image, imgNumBytes);
+                    int pitch) {
+
+        // FreeImage_ConvertFromRawBits would just be one more copy
+        FIBITMAP *bitmap = FreeImage_Allocate(width, height, 32, FI_RGBA_RED_MASK,
+                                              FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK);
+        const cl::Device device = ctx.getInfo<CL_CONTEXT_DEVICES>()[0];
+        if (device.getInfo<CL_DEVICE_HOST_UNIFIED_MEMORY>()) {
+            char *img = mem::map(cmdQueue, image, CL_MAP_READ, (size_t) height * pitch * 4);
+            for (int y = 0; y < height; ++y) {
+                // Bottom up, as in loadBuffer()
+                memcpy(FreeImage_GetScanLine(bitmap, height - 1 - y), img + (size_t) y * pitch * 4,
+                       (size_t) width * 4);
+            }
+            mem::unmap(cmdQueue, image, img);
+        } else {
+            mem::readRows(ctx, cmdQueue, (char *) FreeImage_GetBits(bitmap), image, width * 4, height,
+                          pitch * 4, FreeImage_GetPitch(bitmap));
+            FreeImage_FlipVertical(bitmap);
+        }
 
         FREE_IMAGE_FORMAT format = FreeImage_GetFIFFromFilename(fileName.c_str());
-        FIBITMAP *bitmap = FreeImage_ConvertFromRawBits((BYTE*)buffer,
-                                                        width,
-                                                        height,
-                                                        width * 4,
-                                                        32,
-                                                        0xFF000000,
-                                                        0x00FF0000,
-                                                        0x0000FF00,
-                                                        FALSE);
-
         if (FreeImage_Save(format, bitmap, fileName.c_str()) != TRUE) {
             std::cerr << "Error writing output image: " << fileName << std::endl;
             exit(-1);
         }
-
+        FreeImage_Unload(bitmap);
     }
 
 
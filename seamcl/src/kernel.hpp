@@ -5,6 +5,7 @@
 #include <CL/cl.hpp>
 
 // STL
+#include <algorithm>
 #include <iostream>
 
 // SeamCL
@@ -12,41 +13,203 @@
 #include "setup.hpp"
 #include "math.hpp"
 #include "mem.hpp"
+#include "stats.hpp"
 #include "verify.hpp"
 
 // Wrapper functions around calling kernels
 namespace kernel {
 
     cl::Kernel blurKernel;
+    cl::Kernel laplacianKernel;
+    cl::Kernel paintSeamKernel;
     cl::Kernel gradientKernel;
+    cl::Kernel gradientSeamKernel;
     cl::Kernel maskUnreachableKernel;
     cl::Kernel backtrackKernel;
+    cl::Kernel backtrackBlocksKernel;
+    cl::Kernel backtrackJumpKernel;
+    cl::Kernel backtrackWalkKernel;
     cl::Kernel findMinSeamVertKernel;
+    cl::Kernel findMinPartialsKernel;
     cl::Kernel carveVertKernel;
+    cl::Kernel carveVertGradientKernel;
+    cl::Kernel carveVertInPlaceKernel;
     cl::Kernel computeSeamKernel;
+    cl::Kernel computeSeamLocalKernel;
+    cl::Kernel computeSeamConeKernel;
     cl::Kernel DP_trapezoidKernel;
 
-    void init(cl::Context &ctx) {
-        blurKernel = setup::kernel(ctx, std::string("GaussianKernelBuffer.cl"),
-                                   std::string("gaussian_filter"));
+    // Which DP kernel computeSeams() runs. AUTO takes the trapezoid tiles when the image is more
+    // than one tile wide and the device has more than one compute unit, then the __local row
+    // kernel if two rows fit in local memory, then the plain one.
+    enum DPKernel { DP_AUTO, DP_GLOBAL, DP_LOCAL, DP_TILED, NUM_DP_KERNELS };
 
-        gradientKernel = setup::kernel(ctx, std::string("GradientKernelBuffer.cl"), std::string("image_gradient"));
+    const char *DP_KERNEL_NAMES[NUM_DP_KERNELS] = { "auto", "global", "local", "tiled" };
 
-        maskUnreachableKernel = setup::kernel(ctx, std::string("maskUnreachable.cl"),
-                                              std::string("mask_unreachable"));
+    DPKernel dpKernel = DP_AUTO;
 
-        backtrackKernel = setup::kernel(ctx, std::string("Backtrack.cl"),
-                                        std::string("backtrack_vert"));
+    // Rows per block of the pointer jumping backtrack, see BacktrackJump.cl. It runs two walks of
+    // this many rows and log2(height / BACKTRACK_BLOCK_ROWS) passes in between, against the
+    // height rows backtrack_vert walks.
+    const int BACKTRACK_BLOCK_ROWS = 64;
 
-        computeSeamKernel = setup::kernel(ctx, std::string("computeSeams.cl"),
-                                          std::string("computeSeams"));
-        //DP_trapezoidKernel = setup::kernel(ctx, std::string("DP_trapezoid.cl"), std::string("DP_trapezoid"));
+    int backtrackBlocks(int height) {
+        return (height - 2 + BACKTRACK_BLOCK_ROWS) / BACKTRACK_BLOCK_ROWS;
+    }
 
-        findMinSeamVertKernel= setup::kernel(ctx, std::string("findMinVert.cl"),
-                                             std::string("find_min_vert"));
+    /**
+     * Whether the backtrack should use pointer jumping: --backtrack=serial|jump, or for auto,
+     * when the image is tall enough that the serial walk's dependent reads are the bigger cost.
+     */
+    bool jumpBacktrack(const std::string &mode, int height) {
+        if (mode == "auto") {
+            return height >= 4 * BACKTRACK_BLOCK_ROWS;
+        }
+        return mode == "jump" && height > 1;
+    }
 
-        carveVertKernel = setup::kernel(ctx, std::string("CarveVertBuffer.cl"),
-                                        std::string("carve_vert"));
+    // Per-group minima of the tiled DP's last band, two per tile (a phase each), grown as needed
+    cl::Buffer minPartials;
+    cl::Buffer minPartialIdx;
+    int minPartialsSize = 0;
+
+    // Filled in by startBuild() and init(), for picking the DP kernel
+    size_t costBytes = sizeof(float);
+    cl_ulong localMemBytes = 0;         // what computeSeamsLocal has left for its rows
+    cl_uint computeUnits = 1;
+
+    // Everything the per-seam loop launches, compiled as one program
+    const char *LIVE_SOURCES[] = {
+        "GradientKernelBuffer.cl",
+        "maskUnreachable.cl",
+        "findMinVert.cl",       // before the DP kernels, they use its reduction
+        "computeSeams.cl",
+        "DP_trapezoid.cl",
+        "Backtrack.cl",
+        "BacktrackJump.cl",
+        "CarveVertBuffer.cl",
+        0
+    };
+
+    setup::ProgramBuild liveProgram;
+
+    // Local work size of each live kernel. The 2D kernels use x and y; find-min runs as a single
+    // work group of x items and the DP as groups of x items over tiles x columns wide, see
+    // computeSeams(); backtrack is always one item. tune::load() replaces the defaults with the
+    // device's tuned sizes.
+    struct LocalSize {
+        size_t x, y;
+    };
+
+    LocalSize localSizes[stats::NUM_STAGES] = {
+        { 16, 16 },     // ENERGY
+        { 16, 16 },     // MASK
+        { 256, 1 },     // DP
+        { 256, 1 },     // FINDMIN
+        { 1, 1 },       // BACKTRACK
+        { 16, 16 }      // CARVE
+    };
+
+    cl::Kernel *stageKernel(stats::Stage stage) {
+        switch (stage) {
+        case stats::ENERGY: return &gradientKernel;
+        case stats::MASK: return &maskUnreachableKernel;
+        case stats::DP: return &computeSeamKernel;
+        case stats::FINDMIN: return &findMinSeamVertKernel;
+        case stats::BACKTRACK: return &backtrackKernel;
+        default: return &carveVertKernel;
+        }
+    }
+
+    /**
+     * The biggest work group a stage's kernel accepts (CL_KERNEL_WORK_GROUP_SIZE). The DP has to
+     * fit all of its kernels.
+     */
+    size_t maxWorkGroup(stats::Stage stage, const cl::Device &device) {
+        size_t max = stageKernel(stage)->getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+        if (stage == stats::DP) {
+            max = std::min(max, computeSeamLocalKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+            max = std::min(max, computeSeamConeKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+            max = std::min(max, DP_trapezoidKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+        } else if (stage == stats::CARVE) {
+            max = std::min(max, carveVertGradientKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+            max = std::min(max, carveVertInPlaceKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+        } else if (stage == stats::FINDMIN) {
+            max = std::min(max, findMinPartialsKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device));
+        }
+        return max;
+    }
+
+    /**
+     * Halves the local sizes until each kernel accepts them, so the defaults, or a profile from
+     * a different driver, still launch on small devices.
+     */
+    void fitLocalSizes(const cl::Device &device) {
+        for (int s = 0; s < stats::NUM_STAGES; ++s) {
+            size_t max = maxWorkGroup((stats::Stage) s, device);
+            LocalSize &l = localSizes[s];
+            while (l.x * l.y > max) {
+                if (l.y > 1) {
+                    l.y /= 2;
+                } else {
+                    l.x /= 2;
+                }
+            }
+        }
+    }
+
+    // Sets a buffer argument, NULL in the kernel if buffer is
+    cl_int setBufferArg(cl::Kernel &kernel, cl_uint index, cl::Buffer *buffer) {
+        return buffer ? kernel.setArg(index, *buffer) : kernel.setArg(index, sizeof(cl_mem), NULL);
+    }
+
+    /**
+     * Starts compiling the live kernels in the background, so it overlaps decoding the image.
+     * The blur, laplacian and paint kernels aren't part of it; they're built the first time
+     * they're used.
+     * @param ctx An openCL context object.
+     * @param costPrelude The precision::prelude() for kernels that touch the energy matrix.
+     * @param elementBytes The precision::costBytes() of the same format.
+     */
+    void startBuild(cl::Context &ctx, const std::string &costPrelude, size_t elementBytes) {
+        costBytes = elementBytes;
+        std::string programText = costPrelude;
+        for (const char **file = LIVE_SOURCES; *file; ++file) {
+            programText += "#line 1 \"" + std::string(*file) + "\"\n";
+            programText += setup::source(*file);
+            programText += "\n";
+        }
+        setup::startBuild(liveProgram, ctx, programText, "seamcl kernels", true);
+    }
+
+    /**
+     * Waits for startBuild() and creates the kernels.
+     */
+    void init() {
+        cl::Program &program = setup::finishBuild(liveProgram);
+
+        gradientKernel = setup::kernel(program, "image_gradient");
+        gradientSeamKernel = setup::kernel(program, "image_gradient_seam");
+        maskUnreachableKernel = setup::kernel(program, "mask_unreachable");
+        computeSeamKernel = setup::kernel(program, "computeSeams");
+        computeSeamLocalKernel = setup::kernel(program, "computeSeamsLocal");
+        computeSeamConeKernel = setup::kernel(program, "computeSeamsCone");
+        DP_trapezoidKernel = setup::kernel(program, "DP_trapezoid");
+        findMinSeamVertKernel = setup::kernel(program, "find_min_vert");
+        findMinPartialsKernel = setup::kernel(program, "find_min_partials");
+        backtrackKernel = setup::kernel(program, "backtrack_vert");
+        backtrackBlocksKernel = setup::kernel(program, "backtrack_blocks");
+        backtrackJumpKernel = setup::kernel(program, "backtrack_jump");
+        backtrackWalkKernel = setup::kernel(program, "backtrack_walk");
+        carveVertKernel = setup::kernel(program, "carve_vert");
+        carveVertGradientKernel = setup::kernel(program, "carve_vert_gradient");
+        carveVertInPlaceKernel = setup::kernel(program, "carve_vert_inplace");
+
+        const cl::Device &device = liveProgram.devices[0];
+        localMemBytes = device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>() -
+            computeSeamLocalKernel.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device);
+        computeUnits = device.getInfo<CL_DEVICE_MAX_COMPUTE_UNITS>();
+        fitLocalSizes(device);
     }
 
     /**
@@ -67,6 +230,11 @@ namespace kernel {
               int width,
               int colsRemoved) {
 
+        if (!blurKernel()) {
+            blurKernel = setup::kernel(ctx, std::string("GaussianKernelBuffer.cl"),
+                                       std::string("gaussian_filter"));
+        }
+
         // Set kernel arguments
         cl_int errNum;
 
@@ -110,6 +278,7 @@ namespace kernel {
      * @param sampler An openCL image sampler object.
      * @param height The height of the input image.
      * @param width The width of the input image.
+     * @param pitch Elements a row of the image and the matrix (see mem::pitch()).
      * @return A buffer containing the gradient interpreted as a matrix of size height * width.
      */
     void gradient(cl::Context &ctx,
@@ -120,6 +289,7 @@ namespace kernel {
                   cl::Buffer &energyMatrix,
                   int height,
                   int width,
+                  int pitch,
                   int colsRemoved) {
         cl_int errNum;
 
@@ -128,7 +298,8 @@ namespace kernel {
         errNum |= gradientKernel.setArg(1, energyMatrix);
         errNum |= gradientKernel.setArg(2, width);
         errNum |= gradientKernel.setArg(3, height);
-        errNum |= gradientKernel.setArg(4, colsRemoved);
+        errNum |= gradientKernel.setArg(4, pitch);
+        errNum |= gradientKernel.setArg(5, colsRemoved);
 
         if (errNum != CL_SUCCESS) {
             std::cerr << "Error setting gradient gradientKernel arguments." << std::endl;
@@ -136,15 +307,15 @@ namespace kernel {
         }
 
         cl::NDRange offset = cl::NDRange(0, 0);
-        cl::NDRange localWorkSize = cl::NDRange(16, 16);
-        cl::NDRange globalWorkSize = cl::NDRange(math::roundUp(localWorkSize[0], width),
+        cl::NDRange localWorkSize = cl::NDRange(localSizes[stats::ENERGY].x, localSizes[stats::ENERGY].y);
+        cl::NDRange globalWorkSize = cl::NDRange(math::roundUp(localWorkSize[0], width - colsRemoved),
                                                  math::roundUp(localWorkSize[1], height));
 
         errNum = cmdQueue.enqueueNDRangeKernel(gradientKernel,
                                                offset,
                                                globalWorkSize,
                                                localWorkSize,
-                                               NULL,
+                                               &deps,
                                                &event);
 
         if (errNum != CL_SUCCESS) {
@@ -194,6 +365,56 @@ namespace kernel {
 
     }
 
+    /**
+     * Patches the energy up around the last seam, after carveVert() carved it out of the energy
+     * along with the image. Recomputes a handful of pixels per row, see image_gradient_seam.
+     * @param inputImage The carved image.
+     * @param vertSeamPath The seam that was carved.
+     * @param colsRemoved Counting that seam.
+     */
+    void gradientSeam(cl::Context &ctx,
+                      cl::CommandQueue &cmdQueue,
+                      cl::Event &event,
+                      std::vector<cl::Event> &deps,
+                      cl::Buffer &inputImage,
+                      cl::Buffer &energyMatrix,
+                      cl::Buffer &vertSeamPath,
+                      int height,
+                      int width,
+                      int pitch,
+                      int colsRemoved) {
+        cl_int errNum;
+
+        errNum = gradientSeamKernel.setArg(0, inputImage);
+        errNum |= gradientSeamKernel.setArg(1, energyMatrix);
+        errNum |= gradientSeamKernel.setArg(2, vertSeamPath);
+        errNum |= gradientSeamKernel.setArg(3, width);
+        errNum |= gradientSeamKernel.setArg(4, height);
+        errNum |= gradientSeamKernel.setArg(5, pitch);
+        errNum |= gradientSeamKernel.setArg(6, colsRemoved);
+
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error setting image_gradient_seam kernel arguments." << std::endl;
+            exit(-1);
+        }
+
+        // At most six pixels change per row
+        cl::NDRange offset = cl::NDRange(0, 0);
+        cl::NDRange globalWorkSize = cl::NDRange(8, height);
+
+        errNum = cmdQueue.enqueueNDRangeKernel(gradientSeamKernel,
+                                               offset,
+                                               globalWorkSize,
+                                               cl::NullRange,
+                                               &deps,
+                                               &event);
+
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error enqueuing image_gradient_seam kernel for execution." << std::endl;
+            exit(-1);
+        }
+    }
+
     void maskUnreachable(cl::Context &ctx,
                          cl::CommandQueue &cmdQueue,
                          cl::Event &event,
@@ -216,9 +437,10 @@ namespace kernel {
             std::cerr << "Error setting maskUnreachable kernel arguments." << std::endl;
             exit(-1);
         }
-        cl::NDRange offset = cl::NDRange(0, 0);
-        cl::NDRange localWorkSize = cl::NDRange(16, 16);
-        cl::NDRange globalWorkSize = cl::NDRange(math::roundUp(localWorkSize[0], width),
+        // Just the carved off columns (at least one item, the launch can't be empty)
+        cl::NDRange offset = cl::NDRange(width - colsRemoved, 0);
+        cl::NDRange localWorkSize = cl::NDRange(localSizes[stats::MASK].x, localSizes[stats::MASK].y);
+        cl::NDRange globalWorkSize = cl::NDRange(math::roundUp(localWorkSize[0], std::max(colsRemoved, 1)),
                                                  math::roundUp(localWorkSize[1], height));
 
 
@@ -236,45 +458,272 @@ namespace kernel {
         }
     }
 
+    /**
+     * Runs the DP over the energy matrix with the dpKernel variant:
+     *   tiled   the live columns are split into tiles of localSizes[DP].x columns and bands of
+     *           half that many rows, and run as two DP_trapezoid launches per band with one work
+     *           group per tile, so every compute unit gets a share.
+     *   local   one work group, coalesced columns, the previous row kept in __local memory.
+     *   global  one work group, each item a block of columns, rows synced through global memory.
+     * All of them give identical costs.
+     * @param energyMatrix The energy, left as it is unless costMatrix is the same buffer.
+     * @param costMatrix Gets the cumulative costs. Can be energyMatrix, for a DP in place.
+     * @param parents If not NULL, gets each cell's step to its parent for backtrack()'s pointer
+     *                jumping (a char per cell, pitch wide).
+     * @param event Set to the last launch.
+     * @param launches If not NULL, every launch is appended to it (for the per-kernel stats).
+     * @param verifyDP Recompute the DP on the host from the energy matrix and exit on any
+     *                 mismatch (float precision only, reads the matrices back).
+     * @param vertMinEnergy If not NULL, gets the last row's min, as findMinSeamVert() would
+     *                      (the tiled DP takes one more launch, find_min_partials, for it).
+     * @param vertMinIdx The column of that min, with vertMinEnergy.
+     */
     void computeSeams(cl::Context &ctx,
                       cl::CommandQueue &cmdQueue,
                       cl::Event &event,
                       std::vector<cl::Event> &deps,
                       cl::Buffer &energyMatrix,
+                      cl::Buffer &costMatrix,
+                      cl::Buffer *parents,
                       int width,
                       int height,
                       int pitch,
-                      int colsRemoved) {
+                      int colsRemoved,
+                      std::vector<cl::Event> *launches = NULL,
+                      bool verifyDP = false,
+                      cl::Buffer *vertMinEnergy = NULL,
+                      cl::Buffer *vertMinIdx = NULL) {
 
         cl_int errNum;
+        const size_t items = localSizes[stats::DP].x;
+
+        const int tileWidth = (int) localSizes[stats::DP].x;
+        const int tiles = (width - colsRemoved + tileWidth - 1) / tileWidth;
+        // A band can't be more than half a tile high, or the inverted trapezoids overlap
+        const int bandRows = tileWidth / 2;
+        const bool canTile = (tiles >= 2 && bandRows >= 1 && height > 1);
+        // Two rows of the live width
+        const size_t rowBytes = 2 * (size_t) (width - colsRemoved) * costBytes;
+        // The min's reduction needs a slot per work item alongside them
+        const size_t minBytes = items * (sizeof(float) + sizeof(cl_int));
+        const bool canLocal = (rowBytes + minBytes <= localMemBytes);
+
+        DPKernel variant = dpKernel;
+        if (variant == DP_AUTO) {
+            variant = (canTile && computeUnits > 1) ? DP_TILED : canLocal ? DP_LOCAL : DP_GLOBAL;
+        } else if ((variant == DP_TILED && !canTile) || (variant == DP_LOCAL && !canLocal)) {
+            variant = DP_GLOBAL;
+        }
 
-        // Set kernel arguments
-        errNum = computeSeamKernel.setArg(0, energyMatrix);
-        errNum |= computeSeamKernel.setArg(1, width);
-        errNum |= computeSeamKernel.setArg(2, height);
-        errNum |= computeSeamKernel.setArg(3, pitch);
-        errNum |= computeSeamKernel.setArg(4, colsRemoved);
+        std::vector<float> originalEnergyMatrix;
+        if (verifyDP) {
+            originalEnergyMatrix.resize((size_t) pitch * height);
+            mem::read(ctx, cmdQueue, &originalEnergyMatrix[0], energyMatrix, pitch * height);
+        }
 
-        if (errNum != CL_SUCCESS) {
-            std::cerr << "Error setting computeSeam kernel arguments." << std::endl;
-            exit(-1);
+        // Each launch waits on the one before it, the first on deps
+        std::vector<cl::Event> waitFor(deps);
+        if (energyMatrix() != costMatrix()) {
+            // The kernels only write rows 1 and below, the top row's cost is its energy
+            errNum = cmdQueue.enqueueCopyBuffer(energyMatrix, costMatrix, 0, 0,
+                                                (width - colsRemoved) * costBytes, &waitFor, &event);
+            if (errNum != CL_SUCCESS) {
+                std::cerr << "Error copying the top row of the energy matrix." << std::endl;
+                exit(-1);
+            }
+            if (launches) {
+                launches->push_back(event);
+            }
+            waitFor.assign(1, event);
         }
 
-        cl::NDRange offset = cl::NDRange(0);
-        cl::NDRange localWorkSize = cl::NDRange(256);
-        cl::NDRange globalWorkSize = cl::NDRange(256);
+        if (variant != DP_TILED) {
+            cl::Kernel &dp = (variant == DP_LOCAL) ? computeSeamLocalKernel : computeSeamKernel;
+
+            // Set kernel arguments
+            errNum = dp.setArg(0, energyMatrix);
+            errNum |= dp.setArg(1, costMatrix);
+            errNum |= setBufferArg(dp, 2, parents);
+            errNum |= dp.setArg(3, width);
+            errNum |= dp.setArg(4, height);
+            errNum |= dp.setArg(5, pitch);
+            errNum |= dp.setArg(6, colsRemoved);
+            cl_uint arg = 7;
+            if (variant == DP_LOCAL) {
+                errNum |= dp.setArg(arg++, cl::__local(rowBytes));
+            }
+            errNum |= setBufferArg(dp, arg++, vertMinEnergy);
+            errNum |= setBufferArg(dp, arg++, vertMinIdx);
+            errNum |= dp.setArg(arg++, cl::__local(items * sizeof(float)));
+            errNum |= dp.setArg(arg++, cl::__local(items * sizeof(cl_int)));
+
+            if (errNum != CL_SUCCESS) {
+                std::cerr << "Error setting computeSeam kernel arguments." << std::endl;
+                exit(-1);
+            }
+
+            // One work group, the barrier between rows only works within a group
+            cl::NDRange offset = cl::NDRange(0);
+            cl::NDRange localWorkSize = cl::NDRange(localSizes[stats::DP].x);
+            cl::NDRange globalWorkSize = localWorkSize;
+
+            errNum = cmdQueue.enqueueNDRangeKernel(dp,
+                                                   offset,
+                                                   globalWorkSize,
+                                                   localWorkSize,
+                                                   &waitFor,
+                                                   &event);
+
+            if (errNum != CL_SUCCESS) {
+                std::cerr << "Error enqueuing computeSeams kernel for execution." << std::endl;
+                exit(-1);
+            }
+            if (launches) {
+                launches->push_back(event);
+            }
+        } else {
+            errNum = DP_trapezoidKernel.setArg(0, energyMatrix);
+            errNum |= DP_trapezoidKernel.setArg(1, costMatrix);
+            errNum |= setBufferArg(DP_trapezoidKernel, 2, parents);
+            errNum |= DP_trapezoidKernel.setArg(3, width);
+            errNum |= DP_trapezoidKernel.setArg(4, height);
+            errNum |= DP_trapezoidKernel.setArg(5, pitch);
+            errNum |= DP_trapezoidKernel.setArg(6, colsRemoved);
+            errNum |= DP_trapezoidKernel.setArg(8, bandRows);
+            errNum |= DP_trapezoidKernel.setArg(9, tileWidth);
+            errNum |= DP_trapezoidKernel.setArg(13, cl::__local(items * sizeof(float)));
+            errNum |= DP_trapezoidKernel.setArg(14, cl::__local(items * sizeof(cl_int)));
+
+            if (errNum != CL_SUCCESS) {
+                std::cerr << "Error setting DP_trapezoid kernel arguments." << std::endl;
+                exit(-1);
+            }
+
+            const int numPartials = 2 * tiles;
+            if (vertMinEnergy && numPartials > minPartialsSize) {
+                minPartials = mem::buffer(ctx, cmdQueue, numPartials * sizeof(float));
+                minPartialIdx = mem::buffer(ctx, cmdQueue, numPartials * sizeof(cl_int));
+                minPartialsSize = numPartials;
+            }
+
+            cl::NDRange offset = cl::NDRange(0);
+            cl::NDRange localWorkSize = cl::NDRange(localSizes[stats::DP].x);
+            cl::NDRange globalWorkSize = cl::NDRange(localSizes[stats::DP].x * tiles);
+
+            for (int bandStart = 1; bandStart < height; bandStart += bandRows) {
+                // Only the last band has the last row
+                const bool lastBand = vertMinEnergy && bandStart + bandRows >= height;
+                for (int phase = 0; phase < 2; ++phase) {
+                    errNum = DP_trapezoidKernel.setArg(7, bandStart);
+                    errNum |= DP_trapezoidKernel.setArg(10, phase);
+                    errNum |= setBufferArg(DP_trapezoidKernel, 11, lastBand ? &minPartials : NULL);
+                    errNum |= setBufferArg(DP_trapezoidKernel, 12, lastBand ? &minPartialIdx : NULL);
+                    errNum |= cmdQueue.enqueueNDRangeKernel(DP_trapezoidKernel,
+                                                            offset,
+                                                            globalWorkSize,
+                                                            localWorkSize,
+                                                            &waitFor,
+                                                            &event);
+                    if (errNum != CL_SUCCESS) {
+                        std::cerr << "Error enqueuing DP_trapezoid kernel for execution." << std::endl;
+                        exit(-1);
+                    }
+                    if (launches) {
+                        launches->push_back(event);
+                    }
+                    waitFor.assign(1, event);
+                }
+            }
+
+            if (vertMinEnergy) {
+                const size_t minItems = localSizes[stats::FINDMIN].x;
+                errNum = findMinPartialsKernel.setArg(0, minPartials);
+                errNum |= findMinPartialsKernel.setArg(1, minPartialIdx);
+                errNum |= findMinPartialsKernel.setArg(2, numPartials);
+                errNum |= findMinPartialsKernel.setArg(3, *vertMinEnergy);
+                errNum |= findMinPartialsKernel.setArg(4, *vertMinIdx);
+                errNum |= findMinPartialsKernel.setArg(5, cl::__local(minItems * sizeof(cl_int)));
+                errNum |= findMinPartialsKernel.setArg(6, cl::__local(minItems * sizeof(float)));
+                errNum |= cmdQueue.enqueueNDRangeKernel(findMinPartialsKernel,
+                                                        offset,
+                                                        cl::NDRange(minItems),
+                                                        cl::NDRange(minItems),
+                                                        &waitFor,
+                                                        &event);
+                if (errNum != CL_SUCCESS) {
+                    std::cerr << "Error enqueuing find_min_partials kernel for execution." << std::endl;
+                    exit(-1);
+                }
+                if (launches) {
+                    launches->push_back(event);
+                }
+            }
+        }
 
-        //TODO(amidvidy): this should be configurable with a flag
+        if (verifyDP) {
+            std::vector<float> deviceResult((size_t) pitch * height);
+            mem::read(ctx, cmdQueue, &deviceResult[0], costMatrix, pitch * height);
 
-        /** DEBUGGING */
-        // float *originalEnergyMatrix = new float[width * height];
-        // // read in original data
+            if (!verify::computeSeams(&deviceResult[0], &originalEnergyMatrix[0],
+                                      width, height, pitch, colsRemoved)) {
+                std::cerr << "Incorrect results from kernel::computeSeams" << std::endl;
+                exit(-1);
+            }
+        }
+    }
 
-        // mem::read(ctx, cmdQueue, originalEnergyMatrix, energyMatrix, width * height);
+    /**
+     * Updates the costs computeSeams() (or this) left for the last seam, after carveVert()
+     * carved them along with the image and gradientSeam() patched the energy. Only recomputes
+     * the cone below the seam that actually changed, see computeSeamsCone. Gives the same costs
+     * (and parents) as running computeSeams() again.
+     * @param carvedSeam The seam that was carved.
+     * @param colsRemoved Counting that seam.
+     * @param vertMinEnergy If not NULL, gets the last row's min as in computeSeams().
+     * @param vertMinIdx The column of that min, with vertMinEnergy.
+     */
+    void updateSeams(cl::Context &ctx,
+                     cl::CommandQueue &cmdQueue,
+                     cl::Event &event,
+                     std::vector<cl::Event> &deps,
+                     cl::Buffer &energyMatrix,
+                     cl::Buffer &costMatrix,
+                     cl::Buffer *parents,
+                     cl::Buffer &carvedSeam,
+                     int width,
+                     int height,
+                     int pitch,
+                     int colsRemoved,
+                     bool verifyDP = false,
+                     cl::Buffer *vertMinEnergy = NULL,
+                     cl::Buffer *vertMinIdx = NULL) {
+        cl_int errNum;
+        const size_t items = localSizes[stats::DP].x;
+
+        errNum = computeSeamConeKernel.setArg(0, energyMatrix);
+        errNum |= computeSeamConeKernel.setArg(1, costMatrix);
+        errNum |= setBufferArg(computeSeamConeKernel, 2, parents);
+        errNum |= computeSeamConeKernel.setArg(3, carvedSeam);
+        errNum |= computeSeamConeKernel.setArg(4, width);
+        errNum |= computeSeamConeKernel.setArg(5, height);
+        errNum |= computeSeamConeKernel.setArg(6, pitch);
+        errNum |= computeSeamConeKernel.setArg(7, colsRemoved);
+        errNum |= setBufferArg(computeSeamConeKernel, 8, vertMinEnergy);
+        errNum |= setBufferArg(computeSeamConeKernel, 9, vertMinIdx);
+        errNum |= computeSeamConeKernel.setArg(10, cl::__local(items * sizeof(float)));
+        errNum |= computeSeamConeKernel.setArg(11, cl::__local(items * sizeof(cl_int)));
 
-        /** END DEBUGGING **/
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error setting computeSeamsCone kernel arguments." << std::endl;
+            exit(-1);
+        }
 
-        errNum = cmdQueue.enqueueNDRangeKernel(computeSeamKernel,
+        // One work group, the rows go one after the other
+        cl::NDRange offset = cl::NDRange(0);
+        cl::NDRange localWorkSize = cl::NDRange(localSizes[stats::DP].x);
+        cl::NDRange globalWorkSize = localWorkSize;
+
+        errNum = cmdQueue.enqueueNDRangeKernel(computeSeamConeKernel,
                                                offset,
                                                globalWorkSize,
                                                localWorkSize,
@@ -282,27 +731,32 @@ namespace kernel {
                                                &event);
 
         if (errNum != CL_SUCCESS) {
-            std::cerr << "Error enqueuing computeSeams kernel for execution." << std::endl;
-            // delete [] originalEnergyMatrix;
+            std::cerr << "Error enqueuing computeSeamsCone kernel for execution." << std::endl;
             exit(-1);
         }
 
-        // // /** DEBUGGING **/
-        // float *deviceResult = new float[width * height];
-        // mem::read(ctx, cmdQueue, deviceResult, energyMatrix, width * height);
-
-        // if(!verify::computeSeams(deviceResult, originalEnergyMatrix, width, height, pitch, colsRemoved)) {
-        //     std::cerr << "Incorrect results from kernel::computeSeams" << std::endl;
-        //   delete [] originalEnergyMatrix;
-        //     delete [] deviceResult;
-        //     exit(-1);
-        // }
-
-        // delete [] originalEnergyMatrix;
-        // delete [] deviceResult;
-        // /** END DEBUGGING **/
+        if (verifyDP) {
+            std::vector<float> energy((size_t) pitch * height);
+            std::vector<float> deviceResult((size_t) pitch * height);
+            mem::read(ctx, cmdQueue, &energy[0], energyMatrix, pitch * height);
+            mem::read(ctx, cmdQueue, &deviceResult[0], costMatrix, pitch * height);
+
+            if (!verify::computeSeams(&deviceResult[0], &energy[0],
+                                      width, height, pitch, colsRemoved)) {
+                std::cerr << "Incorrect results from kernel::updateSeams" << std::endl;
+                exit(-1);
+            }
+        }
     }
 
+    /**
+     * Finds the seam from the min find_min_vert left in vertMinIdx. With parents (filled in by
+     * computeSeams()) it runs the pointer jumping kernels of BacktrackJump.cl, otherwise the
+     * single walker of Backtrack.cl; both give the same seam.
+     * @param jumps Two buffers of backtrackBlocks(height) * pitch ints, with parents.
+     * @param event Set to the last launch.
+     * @param launches If not NULL, every launch is appended to it (for the per-kernel stats).
+     */
     void backtrack(cl::Context &ctx,
                    cl::CommandQueue &cmdQueue,
                    cl::Event &event,
@@ -313,10 +767,86 @@ namespace kernel {
                    int width,
                    int height,
                    int pitch,
-                   int colsRemoved) {
+                   int colsRemoved,
+                   cl::Buffer *parents = NULL,
+                   cl::Buffer *jumps = NULL,
+                   std::vector<cl::Event> *launches = NULL) {
 
         cl_int errNum;
 
+        if (parents) {
+            const int blockRows = BACKTRACK_BLOCK_ROWS;
+            const int numBlocks = backtrackBlocks(height);
+            const int liveWidth = width - colsRemoved;
+            cl::NDRange everyBlock = cl::NDRange(liveWidth, numBlocks);
+
+            errNum = backtrackBlocksKernel.setArg(0, *parents);
+            errNum |= backtrackBlocksKernel.setArg(1, jumps[0]);
+            errNum |= backtrackBlocksKernel.setArg(2, width);
+            errNum |= backtrackBlocksKernel.setArg(3, height);
+            errNum |= backtrackBlocksKernel.setArg(4, pitch);
+            errNum |= backtrackBlocksKernel.setArg(5, colsRemoved);
+            errNum |= backtrackBlocksKernel.setArg(6, blockRows);
+            errNum |= backtrackBlocksKernel.setArg(7, numBlocks);
+            if (errNum != CL_SUCCESS) {
+                std::cerr << "Error setting backtrack_blocks kernel arguments." << std::endl;
+                exit(-1);
+            }
+            errNum = cmdQueue.enqueueNDRangeKernel(backtrackBlocksKernel, cl::NDRange(0, 0),
+                                                   everyBlock, cl::NullRange, &deps, &event);
+            if (errNum != CL_SUCCESS) {
+                std::cerr << "Error enqueueing backtrack_blocks kernel for execution." << std::endl;
+                exit(-1);
+            }
+            if (launches) {
+                launches->push_back(event);
+            }
+
+            // Ping pong between the two jump tables
+            int current = 0;
+            std::vector<cl::Event> waitFor(1, event);
+            for (int distance = 1; distance < numBlocks; distance *= 2) {
+                errNum = backtrackJumpKernel.setArg(0, jumps[current]);
+                errNum |= backtrackJumpKernel.setArg(1, jumps[1 - current]);
+                errNum |= backtrackJumpKernel.setArg(2, width);
+                errNum |= backtrackJumpKernel.setArg(3, pitch);
+                errNum |= backtrackJumpKernel.setArg(4, colsRemoved);
+                errNum |= backtrackJumpKernel.setArg(5, numBlocks);
+                errNum |= backtrackJumpKernel.setArg(6, distance);
+                errNum |= cmdQueue.enqueueNDRangeKernel(backtrackJumpKernel, cl::NDRange(0, 0),
+                                                        everyBlock, cl::NullRange, &waitFor, &event);
+                if (errNum != CL_SUCCESS) {
+                    std::cerr << "Error enqueueing backtrack_jump kernel for execution." << std::endl;
+                    exit(-1);
+                }
+                if (launches) {
+                    launches->push_back(event);
+                }
+                waitFor.assign(1, event);
+                current = 1 - current;
+            }
+
+            errNum = backtrackWalkKernel.setArg(0, *parents);
+            errNum |= backtrackWalkKernel.setArg(1, jumps[current]);
+            errNum |= backtrackWalkKernel.setArg(2, vertSeamPath);
+            errNum |= backtrackWalkKernel.setArg(3, vertMinIdx);
+            errNum |= backtrackWalkKernel.setArg(4, height);
+            errNum |= backtrackWalkKernel.setArg(5, pitch);
+            errNum |= backtrackWalkKernel.setArg(6, blockRows);
+            errNum |= backtrackWalkKernel.setArg(7, numBlocks);
+            errNum |= cmdQueue.enqueueNDRangeKernel(backtrackWalkKernel, cl::NDRange(0),
+                                                    cl::NDRange(numBlocks), cl::NullRange,
+                                                    &waitFor, &event);
+            if (errNum != CL_SUCCESS) {
+                std::cerr << "Error enqueueing backtrack_walk kernel for execution." << std::endl;
+                exit(-1);
+            }
+            if (launches) {
+                launches->push_back(event);
+            }
+            return;
+        }
+
         // Set kernel arguments
         errNum = backtrackKernel.setArg(0, energyMatrix);
         errNum |= backtrackKernel.setArg(1, vertSeamPath);
@@ -333,7 +863,7 @@ namespace kernel {
 
         cl::NDRange offset = cl::NDRange(0);
         cl::NDRange localWorkSize = cl::NDRange(1);
-        cl::NDRange globalWorkSize = cl::NDRange(256);
+        cl::NDRange globalWorkSize = cl::NDRange(1);
 
         errNum = cmdQueue.enqueueNDRangeKernel(backtrackKernel,
                                                offset,
@@ -347,6 +877,9 @@ namespace kernel {
             std::cerr << "Error enqueueing backTrack kernel for execution." << std::endl;
             exit(-1);
         }
+        if (launches) {
+            launches->push_back(event);
+        }
 
         // /** DEBUGGING **/
         // int deviceResult[height];
@@ -374,8 +907,9 @@ namespace kernel {
         errNum = findMinSeamVertKernel.setArg(0, energyMatrix);
         errNum |= findMinSeamVertKernel.setArg(1, vertMinEnergy);
         errNum |= findMinSeamVertKernel.setArg(2, vertMinIdx);
-        errNum |= findMinSeamVertKernel.setArg(3, cl::__local(256 * sizeof(float)));
-        errNum |= findMinSeamVertKernel.setArg(4, cl::__local(256 * sizeof(float)));
+        const size_t items = localSizes[stats::FINDMIN].x;
+        errNum |= findMinSeamVertKernel.setArg(3, cl::__local(items * sizeof(cl_int)));
+        errNum |= findMinSeamVertKernel.setArg(4, cl::__local(items * sizeof(float)));
         errNum |= findMinSeamVertKernel.setArg(5, width);
         errNum |= findMinSeamVertKernel.setArg(6, height);
         errNum |= findMinSeamVertKernel.setArg(7, pitch);
@@ -389,8 +923,8 @@ namespace kernel {
         // This kernel could be written to use more than one work group, but its probably not worth it.
 
         cl::NDRange offset = cl::NDRange(0);
-        cl::NDRange localWorkSize = cl::NDRange(256);
-        cl::NDRange globalWorkSize = cl::NDRange(256);
+        cl::NDRange localWorkSize = cl::NDRange(items);
+        cl::NDRange globalWorkSize = cl::NDRange(items);
 
         errNum = cmdQueue.enqueueNDRangeKernel(findMinSeamVertKernel,
                                                offset,
@@ -436,8 +970,11 @@ namespace kernel {
 
 
         // Setup kernel
-        cl::Kernel kernel = setup::kernel(ctx, std::string("LaplacianGaussianKernel.cl"),
-                                          std::string("gaussian_laplacian"));
+        if (!laplacianKernel()) {
+            laplacianKernel = setup::kernel(ctx, std::string("LaplacianGaussianKernel.cl"),
+                                            std::string("gaussian_laplacian"));
+        }
+        cl::Kernel &kernel = laplacianKernel;
 
         cl_int errNum;
 
@@ -518,7 +1055,10 @@ namespace kernel {
                    int width,
                    int height) {
 
-        cl::Kernel kernel = setup::kernel(ctx, std::string("PaintSeam.cl"), std::string("paint_seam"));
+        if (!paintSeamKernel()) {
+            paintSeamKernel = setup::kernel(ctx, std::string("PaintSeam.cl"), std::string("paint_seam"));
+        }
+        cl::Kernel &kernel = paintSeamKernel;
 
         cl_int errNum;
 
@@ -548,6 +1088,17 @@ namespace kernel {
 
     }
 
+    // Matrices carveVert() carves along with the image so the next seam can patch them up
+    // rather than start over, NULL for the ones it doesn't
+    struct Carried {
+        cl::Buffer *energy, *cost, *parents;
+    };
+
+    /**
+     * Carves the seam out of inputImage into outputImage.
+     * @param from Matrices to carve the same way, into the ones in to. Value initialised (all
+     *             NULL) carves just the image.
+     */
     void carveVert(cl::Context &ctx,
                    cl::CommandQueue &cmdQueue,
                    cl::Event &event,
@@ -557,16 +1108,26 @@ namespace kernel {
                    cl::Buffer &vertSeamPath,
                    int width,
                    int height,
-                   int numRowsCarved) {
+                   int pitch,
+                   int numRowsCarved,
+                   const Carried &from = Carried(),
+                   const Carried &to = Carried()) {
 
         cl_int errNum;
 
         errNum = carveVertKernel.setArg(0, inputImage);
         errNum |= carveVertKernel.setArg(1, outputImage);
         errNum |= carveVertKernel.setArg(2, vertSeamPath);
-        errNum |= carveVertKernel.setArg(3, width);
-        errNum |= carveVertKernel.setArg(4, height);
-        errNum |= carveVertKernel.setArg(5, numRowsCarved);
+        errNum |= setBufferArg(carveVertKernel, 3, from.energy);
+        errNum |= setBufferArg(carveVertKernel, 4, to.energy);
+        errNum |= setBufferArg(carveVertKernel, 5, from.cost);
+        errNum |= setBufferArg(carveVertKernel, 6, to.cost);
+        errNum |= setBufferArg(carveVertKernel, 7, from.parents);
+        errNum |= setBufferArg(carveVertKernel, 8, to.parents);
+        errNum |= carveVertKernel.setArg(9, width);
+        errNum |= carveVertKernel.setArg(10, height);
+        errNum |= carveVertKernel.setArg(11, pitch);
+        errNum |= carveVertKernel.setArg(12, numRowsCarved);
 
         if (errNum != CL_SUCCESS) {
             std::cerr << "Error setting carveVert kernel arguments." << std::endl;
@@ -574,8 +1135,8 @@ namespace kernel {
         }
 
         cl::NDRange offset = cl::NDRange(0, 0);
-        cl::NDRange localWorkSize = cl::NDRange(16, 16);
-        cl::NDRange globalWorkSize = cl::NDRange(math::roundUp(localWorkSize[0], width),
+        cl::NDRange localWorkSize = cl::NDRange(localSizes[stats::CARVE].x, localSizes[stats::CARVE].y);
+        cl::NDRange globalWorkSize = cl::NDRange(math::roundUp(localWorkSize[0], width - numRowsCarved),
                                                  math::roundUp(localWorkSize[1], height));
         errNum = cmdQueue.enqueueNDRangeKernel(carveVertKernel,
                                                offset,
@@ -589,6 +1150,111 @@ namespace kernel {
         }
     }
 
+    /**
+     * Carves the seam out of image in place, shifting only what's right of it, along with the
+     * carried matrices (which stay in the same buffers). One work group of
+     * localSizes[CARVE].x * y items per row.
+     */
+    void carveVertInPlace(cl::Context &ctx,
+                          cl::CommandQueue &cmdQueue,
+                          cl::Event &event,
+                          std::vector<cl::Event> &deps,
+                          cl::Buffer &image,
+                          cl::Buffer &vertSeamPath,
+                          int width,
+                          int height,
+                          int pitch,
+                          int numRowsCarved,
+                          const Carried &carried = Carried()) {
+
+        cl_int errNum;
+
+        errNum = carveVertInPlaceKernel.setArg(0, image);
+        errNum |= carveVertInPlaceKernel.setArg(1, vertSeamPath);
+        errNum |= setBufferArg(carveVertInPlaceKernel, 2, carried.energy);
+        errNum |= setBufferArg(carveVertInPlaceKernel, 3, carried.cost);
+        errNum |= setBufferArg(carveVertInPlaceKernel, 4, carried.parents);
+        errNum |= carveVertInPlaceKernel.setArg(5, width);
+        errNum |= carveVertInPlaceKernel.setArg(6, height);
+        errNum |= carveVertInPlaceKernel.setArg(7, pitch);
+        errNum |= carveVertInPlaceKernel.setArg(8, numRowsCarved);
+
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error setting carveVertInPlace kernel arguments." << std::endl;
+            exit(-1);
+        }
+
+        const size_t items = localSizes[stats::CARVE].x * localSizes[stats::CARVE].y;
+        cl::NDRange offset = cl::NDRange(0);
+        cl::NDRange localWorkSize = cl::NDRange(items);
+        cl::NDRange globalWorkSize = cl::NDRange(items * height);
+        errNum = cmdQueue.enqueueNDRangeKernel(carveVertInPlaceKernel,
+                                               offset,
+                                               globalWorkSize,
+                                               localWorkSize,
+                                               &deps,
+                                               &event);
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error enqueueing carveVertInPlace kernel for execution." << std::endl;
+            exit(-1);
+        }
+    }
+
+    /**
+     * Carves the seam out of inputImage into outputImage and writes the carved image's energy
+     * to energyMatrix, standing in for the next seam's gradient() and maskUnreachable(). Runs
+     * in groups of localSizes[CARVE], each with its tile's luminance and a one pixel halo in
+     * local memory.
+     */
+    void carveVertGradient(cl::Context &ctx,
+                           cl::CommandQueue &cmdQueue,
+                           cl::Event &event,
+                           std::vector<cl::Event> &deps,
+                           cl::Buffer &inputImage,
+                           cl::Buffer &outputImage,
+                           cl::Buffer &vertSeamPath,
+                           cl::Buffer &energyMatrix,
+                           int width,
+                           int height,
+                           int pitch,
+                           int numRowsCarved) {
+
+        cl_int errNum;
+
+        cl::NDRange offset = cl::NDRange(0, 0);
+        cl::NDRange localWorkSize = cl::NDRange(localSizes[stats::CARVE].x, localSizes[stats::CARVE].y);
+        cl::NDRange globalWorkSize = cl::NDRange(math::roundUp(localWorkSize[0], width - numRowsCarved),
+                                                 math::roundUp(localWorkSize[1], height));
+        // lum_t is an int or a float, 4 bytes either way
+        const size_t lumBytes = (localWorkSize[0] + 2) * (localWorkSize[1] + 2) * sizeof(float);
+
+        errNum = carveVertGradientKernel.setArg(0, inputImage);
+        errNum |= carveVertGradientKernel.setArg(1, outputImage);
+        errNum |= carveVertGradientKernel.setArg(2, vertSeamPath);
+        errNum |= carveVertGradientKernel.setArg(3, energyMatrix);
+        errNum |= carveVertGradientKernel.setArg(4, width);
+        errNum |= carveVertGradientKernel.setArg(5, height);
+        errNum |= carveVertGradientKernel.setArg(6, pitch);
+        errNum |= carveVertGradientKernel.setArg(7, numRowsCarved);
+        errNum |= carveVertGradientKernel.setArg(8, cl::__local(lumBytes));
+
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error setting carveVertGradient kernel arguments." << std::endl;
+            exit(-1);
+        }
+
+        errNum = cmdQueue.enqueueNDRangeKernel(carveVertGradientKernel,
+                                               offset,
+                                               globalWorkSize,
+                                               localWorkSize,
+                                               &deps,
+                                               &event);
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error enqueueing carveVertGradient kernel for execution." << std::endl;
+            exit(-1);
+        }
+    }
+
 } // namespace kernel {
 
 #endif
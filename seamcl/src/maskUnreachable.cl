@@ -1,16 +1,18 @@
-__kernel void mask_unreachable(__global float *energyMatrix,
+__kernel void mask_unreachable(__global cost_t *energyMatrix,
                                   int width,
                                   int height,
                                   int pitch,
                                   int colsRemoved) {
-#define rM(M,X,Y) (M)[((Y)*pitch+(X))]
-#define RADIUS 1 // mask off gaussian values that have been tainted by garbage
+#define rI(X,Y) ((Y)*pitch+(X))
+// The gradient clamps its stencil to the live image, so only the carved off columns on the right
+// hold garbage. (Column 0 used to be masked too, which left it uncarvable, unlike seamc.) The
+// launch starts at the first carved off column.
     int2 myCell = (int2) (get_global_id(0), get_global_id(1));
 
-    if (myCell.x < RADIUS) {
-        rM(energyMatrix, myCell.x, myCell.y) = MAXFLOAT;
-    } else if (myCell.x < width && myCell.x > (width - (RADIUS + colsRemoved))) {
-        rM(energyMatrix, myCell.x, myCell.y) = MAXFLOAT;
+    if (myCell.y >= height) {
+        return;
+    } else if (myCell.x < width && myCell.x >= (width - colsRemoved)) {
+        COST_STORE(energyMatrix, rI(myCell.x, myCell.y), COST_MAX);
     }
 }
 
@@ -1,9 +1,31 @@
 #ifndef MEM_HPP
 #define MEM_HPP
 
+// STL
+#include <algorithm>
+#include <vector>
+
+// SeamCL
+#include "math.hpp"
+
 // Functions relating to allocating device memory, and marshalling data back and forth from the device.
 namespace mem {
 
+    /**
+     * Row pitch, in elements, of the image and the matrices: width rounded up so every row
+     * starts on the device's base address alignment (CL_DEVICE_MEM_BASE_ADDR_ALIGN), or its
+     * cache line if that's wider. Rounding the element count keeps even the byte wide parent
+     * rows aligned, and so the wider ones too.
+     */
+    int pitch(const cl::Device &device, int width) {
+        size_t align = device.getInfo<CL_DEVICE_MEM_BASE_ADDR_ALIGN>() / 8; // in bits
+        align = std::max(align, (size_t) device.getInfo<CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE>());
+        if (align == 0) {
+            align = 64;
+        }
+        return (int) math::roundUp((int) align, width);
+    }
+
     cl::Buffer buffer(cl::Context &ctx,
                       cl::CommandQueue &cmdQueue,
                       int numBytes) {
@@ -22,6 +44,32 @@ namespace mem {
         return buff;
     }
 
+    /**
+     * Maps the first numBytes of a buffer() into host memory, waiting until it's there. Its
+     * CL_MEM_ALLOC_HOST_PTR memory is what the device itself uses where the two share memory
+     * (CPUs, integrated GPUs), so mapping and unmap() copy nothing; elsewhere the driver moves
+     * it in one transfer each way.
+     * @param flags CL_MAP_READ, CL_MAP_WRITE or both.
+     */
+    char *map(cl::CommandQueue &cmdQueue, cl::Buffer &buff, cl_map_flags flags, size_t numBytes) {
+        cl_int errNum;
+        void *ptr = cmdQueue.enqueueMapBuffer(buff, CL_TRUE, flags, 0, numBytes, NULL, NULL, &errNum);
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error mapping buffer into host memory." << std::endl;
+            exit(-1);
+        }
+        return (char *) ptr;
+    }
+
+    // Hands a map()ped buffer back to the device; the kernels enqueued after it see the writes.
+    void unmap(cl::CommandQueue &cmdQueue, cl::Buffer &buff, char *ptr) {
+        cl_int errNum = cmdQueue.enqueueUnmapMemObject(buff, ptr);
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error unmapping buffer." << std::endl;
+            exit(-1);
+        }
+    }
+
     template<typename T>
     cl::Buffer bufferFromHostArray(cl::Context &ctx,
                                    cl::CommandQueue &cmdQueue,
@@ -57,6 +105,26 @@ namespace mem {
         }
     }
 
+    /**
+     * Enqueues a read without waiting for it. arr must stay valid until the queue is finished
+     * (or event has completed).
+     */
+    template<typename T>
+    void readAsync(cl::Context &ctx, cl::CommandQueue &cmdQueue, T *arr, cl::Buffer &buff, size_t size,
+                   cl::Event *event = NULL) {
+        cl_int errNum = cmdQueue.enqueueReadBuffer(buff,
+                                                   CL_FALSE,
+                                                   0,
+                                                   size * sizeof(T),
+                                                   (void *) arr,
+                                                   NULL,
+                                                   event);
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error reading buffer from device to host." << std::endl;
+            exit(-1);
+        }
+    }
+
     // This only works for stack allocated arrays.
     template<typename T, std::size_t sz>
     void read(cl::Context &ctx, cl::CommandQueue &cmdQueue, T(&arr)[sz], cl::Buffer &buff) {
@@ -105,7 +173,113 @@ namespace mem {
         }
     }
 
-    
+    /**
+     * Reads height rows of width elements out of a buffer pitch elements a row, into arr
+     * packed, or hostPitch elements a row.
+     */
+    template<typename T>
+    void readRows(cl::Context &ctx, cl::CommandQueue &cmdQueue, T *arr, cl::Buffer &buff,
+                  int width, int height, int pitch, int hostPitch = 0) {
+        cl::size_t<3> origin;
+        origin.push_back(0);
+        origin.push_back(0);
+        origin.push_back(0);
+        cl::size_t<3> region;
+        region.push_back(width * sizeof(T));
+        region.push_back(height);
+        region.push_back(1);
+        cl_int errNum = cmdQueue.enqueueReadBufferRect(buff,
+                                                       CL_TRUE,
+                                                       origin,
+                                                       origin,
+                                                       region,
+                                                       pitch * sizeof(T),
+                                                       0,
+                                                       (hostPitch ? hostPitch : width) * sizeof(T),
+                                                       0,
+                                                       (void *) arr,
+                                                       NULL,
+                                                       NULL);
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error reading buffer rows from device to host." << std::endl;
+            exit(-1);
+        }
+    }
+
+    // The other way round: packed rows from arr into a buffer pitch elements a row.
+    template<typename T>
+    void writeRows(cl::Context &ctx, cl::CommandQueue &cmdQueue, T *arr, cl::Buffer &buff,
+                   int width, int height, int pitch) {
+        cl::size_t<3> origin;
+        origin.push_back(0);
+        origin.push_back(0);
+        origin.push_back(0);
+        cl::size_t<3> region;
+        region.push_back(width * sizeof(T));
+        region.push_back(height);
+        region.push_back(1);
+        cl_int errNum = cmdQueue.enqueueWriteBufferRect(buff,
+                                                        CL_TRUE,
+                                                        origin,
+                                                        origin,
+                                                        region,
+                                                        pitch * sizeof(T),
+                                                        0,
+                                                        width * sizeof(T),
+                                                        0,
+                                                        (void *) arr,
+                                                        NULL,
+                                                        NULL);
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Error writing buffer rows from host to device." << std::endl;
+            exit(-1);
+        }
+    }
+
+    /**
+     * Replaces buff with a buffer of height rows pitch elements (of elementBytes) apart. If copy
+     * is set the first width elements of each row are copied over from buff, whose rows were
+     * oldPitch apart; the copy waits on after, which then becomes the copy's own event.
+     */
+    void repitch(cl::Context &ctx,
+                 cl::CommandQueue &cmdQueue,
+                 cl::Buffer &buff,
+                 size_t elementBytes,
+                 int width,
+                 int height,
+                 int oldPitch,
+                 int pitch,
+                 bool copy,
+                 cl::Event &after) {
+        cl::Buffer repitched = buffer(ctx, cmdQueue, height * pitch * elementBytes);
+        if (copy) {
+            cl::size_t<3> origin;
+            origin.push_back(0);
+            origin.push_back(0);
+            origin.push_back(0);
+            cl::size_t<3> region;
+            region.push_back(width * elementBytes);
+            region.push_back(height);
+            region.push_back(1);
+            std::vector<cl::Event> deps(1, after);
+            cl_int errNum = cmdQueue.enqueueCopyBufferRect(buff,
+                                                           repitched,
+                                                           origin,
+                                                           origin,
+                                                           region,
+                                                           oldPitch * elementBytes,
+                                                           0,
+                                                           pitch * elementBytes,
+                                                           0,
+                                                           &deps,
+                                                           &after);
+            if (errNum != CL_SUCCESS) {
+                std::cerr << "Error copying buffer rows on the device." << std::endl;
+                exit(-1);
+            }
+        }
+        buff = repitched;
+    }
 
 } // namespace mem {
 
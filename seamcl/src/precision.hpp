@@ -0,0 +1,156 @@
+#ifndef PRECISION_HPP
+#define PRECISION_HPP
+
+// C
+#include <cstring>
+
+// STL
+#include <sstream>
+#include <string>
+
+// OpenCL
+#include <CL/cl.hpp>
+
+// Storage formats for the energy/cost matrix. The DP only needs the ordering of path costs,
+// so it can get away with fewer bytes per pixel. Each format is a prelude of typedefs and
+// macros that gets prepended to the kernel sources, so the kernels are only written once:
+//   cost_t              element type of the matrix in global memory
+//   costf_t             type the kernels do arithmetic in (always 4 bytes)
+//   COST_LOAD/STORE     read/write an element
+//   COST_MAX            unreachable (masked) cell
+//   COST_SAT            largest reachable cost, sums saturate here rather than overflowing
+//   COST_ADD(e, c)      energy plus path cost; masked energy stays masked
+//   ENERGY(g)           converts a Sobel gradient (lum_t) to costf_t
+//   lum_t, LUM(p)       luminance type, and luminance of a BGRA uchar4 pixel
+//   LUM_ABS(v)          absolute value of a lum_t
+//   SEAM_STEP(l, c, r)  the seam tie rule, -1/0/1 for a step up to the left/centre/right
+//
+// INT computes the energy from integer luminance in integer arithmetic, so it doesn't depend on
+// how a device rounds floats: the host (verify::hostSeam) and seamc --precision=int produce the
+// same seams bit for bit.
+//
+// The tie rule is the same everywhere (seamc, hostSeam and every kernel): the bottom row takes
+// the leftmost minimum, then each step up takes the centre if it is no worse than either side,
+// else the left if it is no worse than the right, else the right.
+namespace precision {
+
+    enum Mode { FLOAT, FIXED, HALF, INT };
+
+    // Sobel of 0..255 luminance tops out at 2 * 4 * 255.
+    const float MAX_ENERGY = 2040.0f;
+    // 2040 * 32 < 65535, so fixed point energy is a uint16 value with 5 fractional bits.
+    const float FIXED_SCALE = 32.0f;
+    const float HALF_SAT = 65504.0f;
+
+    bool parse(const std::string &name, Mode &mode) {
+        if (name == "float") {
+            mode = FLOAT;
+        } else if (name == "fixed") {
+            mode = FIXED;
+        } else if (name == "half") {
+            mode = HALF;
+        } else if (name == "int") {
+            mode = INT;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    const char *name(Mode mode) {
+        switch (mode) {
+        case FIXED: return "fixed";
+        case HALF: return "half";
+        case INT: return "int";
+        default: return "float";
+        }
+    }
+
+    size_t costBytes(Mode mode) {
+        return (mode == HALF) ? 2 : 4;
+    }
+
+    /**
+     * Builds the kernel prelude for a storage format.
+     * @param mode The storage format.
+     * @param height The image height. Half precision scales the energy down so that even the
+     *               worst case seam can't reach HALF_SAT.
+     * @return OpenCL source to prepend to each kernel.
+     */
+    std::string prelude(Mode mode, int height) {
+        std::ostringstream s;
+        s.precision(9);
+        s << std::showpoint;
+        s << "#define SEAM_STEP(l, c, r) ((((c) <= (l)) && ((c) <= (r))) ? 0 : ((l) <= (r)) ? -1 : 1)\n";
+        if (mode == INT) {
+            // Rec. 601 weights in 8 bits, 77 + 150 + 29 = 256
+            s << "typedef int lum_t;\n"
+              << "#define LUM(p) ((77 * (int)(p).z + 150 * (int)(p).y + 29 * (int)(p).x + 128) >> 8)\n"
+              << "#define LUM_ABS(v) ((int)abs(v))\n";
+        } else {
+            s << "typedef float lum_t;\n"
+              << "#define LUM(p) ((float)(p).z * 0.299f + (float)(p).y * 0.587f + (float)(p).x * 0.114f)\n"
+              << "#define LUM_ABS(v) fabs(v)\n";
+        }
+        switch (mode) {
+        case INT:
+        case FIXED:
+            s << "typedef uint cost_t;\n"
+              << "typedef uint costf_t;\n"
+              << "#define COST_MAX UINT_MAX\n"
+              << "#define COST_SAT (UINT_MAX - 1)\n"
+              << "#define COST_LOAD(M, i) ((M)[i])\n"
+              << "#define COST_STORE(M, i, v) ((M)[i] = (v))\n"
+              << "#define COST_ADD(e, c) (((e) == COST_MAX) ? COST_MAX : min(add_sat((e), (c)), COST_SAT))\n";
+            if (mode == INT) {
+                s << "#define ENERGY(g) ((uint)(g))\n";
+            } else {
+                s << "#define ENERGY(g) min(convert_uint_sat_rte((g) * " << FIXED_SCALE << "f), 65535u)\n";
+            }
+            break;
+        case HALF:
+            // vload_half/vstore_half are core OpenCL, so this doesn't need cl_khr_fp16; the
+            // arithmetic is done in float and rounded once on store.
+            s << "typedef half cost_t;\n"
+              << "typedef float costf_t;\n"
+              << "#define COST_MAX INFINITY\n"
+              << "#define COST_SAT " << HALF_SAT << "f\n"
+              << "#define COST_LOAD(M, i) vload_half((i), (M))\n"
+              << "#define COST_STORE(M, i, v) vstore_half((v), (i), (M))\n"
+              << "#define COST_ADD(e, c) (isinf(e) ? (e) : fmin((e) + (c), COST_SAT))\n"
+              << "#define ENERGY(g) ((g) * " << HALF_SAT / (MAX_ENERGY * height) << "f)\n";
+            break;
+        default:
+            s << "typedef float cost_t;\n"
+              << "typedef float costf_t;\n"
+              << "#define COST_MAX MAXFLOAT\n"
+              << "#define COST_SAT MAXFLOAT\n"
+              << "#define COST_LOAD(M, i) ((M)[i])\n"
+              << "#define COST_STORE(M, i, v) ((M)[i] = (v))\n"
+              << "#define COST_ADD(e, c) ((e) + (c))\n"
+              << "#define ENERGY(g) (g)\n";
+            break;
+        }
+        return s.str();
+    }
+
+    /**
+     * Checks whether a min seam cost (as written by find_min_vert) hit the saturation ceiling,
+     * in which case every saturated seam ties and the chosen one is arbitrary.
+     * @param mode The storage format.
+     * @param minCost The raw 4 bytes of the min cost.
+     */
+    bool saturated(Mode mode, cl_uint minCost) {
+        if (mode == FIXED || mode == INT) {
+            return minCost >= CL_UINT_MAX - 1;
+        } else if (mode == HALF) {
+            float f;
+            memcpy(&f, &minCost, sizeof(f));
+            return f >= HALF_SAT;
+        }
+        return false;
+    }
+
+} // namespace precision
+
+#endif
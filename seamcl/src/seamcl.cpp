@@ -20,7 +20,11 @@
 #include "kernel.hpp"
 #include "math.hpp"
 #include "mem.hpp"
+#include "precision.hpp"
 #include "setup.hpp"
+#include "stats.hpp"
+#include "trace.hpp"
+#include "tune.hpp"
 #include "verify.hpp"
 
 
@@ -29,53 +33,146 @@ int main(int argc, char** argv) {
     // Parse arguments
     std::string inputFile, outputFile;
     int colsToRemove;
-    setup::args(argc, argv, inputFile, outputFile, colsToRemove);
+    setup::Options opts;
+    setup::args(argc, argv, inputFile, outputFile, colsToRemove, opts);
+    trace::Trace tracer(!opts.traceFile.empty());
 
     // Create OpenCL context
-    cl::Context context = setup::context();
+    cl::Context context = setup::context(opts);
     // Create commandQueue
-    cl::CommandQueue cmdQueue = setup::commandQueue(context);
+    cl::CommandQueue cmdQueue = setup::commandQueue(context, opts.profiling());
 
-    // Load image into a buffer
+    // Compile the kernels while the image decodes, the prelude only needs the height
     int width, height;
-    //cl::Image2D inputImage = image::load(context, inputFile, height, width);
-    char *origCharBuffer = 0;
-    cl::Buffer inputImageBuffer = image::loadBuffer(context, cmdQueue, inputFile, height, width, origCharBuffer);
+    image::size(inputFile, height, width);
+    stats::Tick compileStart = stats::tick();
+    kernel::startBuild(context, precision::prelude(opts.precision, height),
+                       precision::costBytes(opts.precision));
+
+    // Every buffer's rows are pitch elements apart, so each row starts aligned
+    const cl::Device device = context.getInfo<CL_CONTEXT_DEVICES>()[0];
+    int pitch = mem::pitch(device, width);
 
-    // just in case we end up using padding
-    int pitch = width;
+    // Load image into a buffer
+    //cl::Image2D inputImage = image::load(context, inputFile, height, width);
+    stats::Tick loadStart = stats::tick();
+    cl::Buffer inputImageBuffer = image::loadBuffer(context, cmdQueue, inputFile, height, width, pitch);
+    tracer.host("load", loadStart, stats::tick());
 
     // Make sampler
     //cl::Sampler sampler = image::sampler(context);
 
-    // Intermediate buffer to hold blurred image.
+    const bool incrementalEnergy = (opts.energy == "incremental");
+    const bool fusedEnergy = (opts.energy == "fused");
+    const bool coneDP = incrementalEnergy && opts.dpUpdate == "cone";
+    // The DP leaves the min of its last row in vertMinEnergy/vertMinIdx itself
+    const bool fusedMin = (opts.findMin == "fused");
+    // The fused carve reads the pixels around the ones it moves, and --compare needs the image
+    // the seam was found in after the carve, so both copy into the other image buffer
+    const bool inPlaceCarve = (opts.carve == "inplace") && !fusedEnergy && !opts.compare;
+
+    // Intermediate buffer to hold blurred image. (The copying carve's output, the in-place one
+    // doesn't need it.)
     //cl::Image2D blurredImage = image::make(context, height, width);
-    cl::Buffer blurredImageBuffer = mem::buffer(context, cmdQueue, height * width * 4);
+    cl::Buffer blurredImageBuffer;
+    if (!inPlaceCarve) {
+        blurredImageBuffer = mem::buffer(context, cmdQueue, height * pitch * 4);
+    }
 
-    // Allocate space on device for energy matrix
-    cl::Buffer energyMatrix = mem::buffer(context, cmdQueue, height * width * sizeof(float));
+    // Allocate space on device for energy matrix. With --energy=incremental the carve carries
+    // the energy over to the next seam (ping-ponging like the image unless it carves in place)
+    // and only the pixels around the seam are recomputed, so the cumulative costs need a buffer
+    // of their own. --dp-update=cone carries the costs over the same way. Otherwise the DP
+    // overwrites the energy in place, and with --energy=fused the carve then writes the next
+    // seam's energy over it.
+    const size_t matrixBytes = (size_t) height * pitch * precision::costBytes(opts.precision);
+    cl::Buffer energyMatrix[2], costMatrix[2];
+    energyMatrix[0] = mem::buffer(context, cmdQueue, matrixBytes);
+    costMatrix[0] = energyMatrix[0];
+    if (incrementalEnergy) {
+        costMatrix[0] = mem::buffer(context, cmdQueue, matrixBytes);
+        if (!inPlaceCarve) {
+            energyMatrix[1] = mem::buffer(context, cmdQueue, matrixBytes);
+        }
+    }
+    if (coneDP && !inPlaceCarve) {
+        costMatrix[1] = mem::buffer(context, cmdQueue, matrixBytes);
+    }
 
-    // Holds the current energy of the min vertical seam
+    // Holds the current energy of the min vertical seam (a costf_t, 4 bytes in every precision)
     cl::Buffer vertMinEnergy = mem::buffer(context, cmdQueue, sizeof(float));
     // Holds the starting index of the min vertical seam
     cl::Buffer vertMinIdx = mem::buffer(context, cmdQueue, sizeof(int));
     // Holds the indexes of of the min vertical seam
     cl::Buffer vertSeamPath = mem::buffer(context, cmdQueue, sizeof(int) * height);
 
+    // The DP's parent steps (carried over like the costs) and the two jump tables for the
+    // pointer jumping backtrack
+    cl::Buffer seamParents[2], seamJumps[2];
+    const bool jumpBacktrack = kernel::jumpBacktrack(opts.backtrack, height);
+    if (jumpBacktrack) {
+        seamParents[0] = mem::buffer(context, cmdQueue, height * pitch);
+        if (coneDP && !inPlaceCarve) {
+            seamParents[1] = mem::buffer(context, cmdQueue, height * pitch);
+        }
+        for (int i = 0; i < 2; ++i) {
+            seamJumps[i] = mem::buffer(context, cmdQueue,
+                                       sizeof(int) * pitch * kernel::backtrackBlocks(height));
+        }
+    }
+
     // Init kernels
-    kernel::init(context);
+    kernel::init();
+    for (int k = 0; k < kernel::NUM_DP_KERNELS; ++k) {
+        if (opts.dp == kernel::DP_KERNEL_NAMES[k]) {
+            kernel::dpKernel = (kernel::DPKernel) k;
+        }
+    }
+    tracer.host("compile", compileStart, stats::tick(), trace::COMPILER);
+
+    // Work group sizes, tuned now or from an earlier --autotune
+    const std::string tuneProfile = tune::profilePath(opts.tuneProfile, device);
+    if (opts.autotune) {
+        tune::Pipeline pipeline = { opts.energy, coneDP, fusedMin, inPlaceCarve };
+        tune::Buffers buffers = { &inputImageBuffer, &blurredImageBuffer, &energyMatrix[0],
+                                  &costMatrix[0], jumpBacktrack ? &seamParents[0] : NULL,
+                                  jumpBacktrack ? seamJumps : NULL,
+                                  &vertMinEnergy, &vertMinIdx, &vertSeamPath };
+        stats::Tick tuneStart = stats::tick();
+        tune::run(context, device, pipeline, buffers, width, height, pitch);
+        tune::save(tuneProfile, device, width, height);
+        tracer.host("autotune", tuneStart, stats::tick());
+    } else {
+        tune::load(tuneProfile, device, width, height);
+    }
 
     // We are going to need to swap pointers each iteration
     //cl::Image2D *curInputImage = &inputImage;
     //cl::Image2D *curOutputImage = &blurredImage;
 
+    // (Both the same buffer when carving in place, so the swaps change nothing.)
     cl::Buffer *curInputImage = &inputImageBuffer;
-    cl::Buffer *curOutputImage = &blurredImageBuffer;
-
-    uint64 totalTimeMillis = 0;
+    cl::Buffer *curOutputImage = inPlaceCarve ? &inputImageBuffer : &blurredImageBuffer;
+    // This seam's matrices, and where the carve puts them for the next (the same buffers for
+    // the ones that aren't carried over, or when carving in place)
+    kernel::Carried cur = { &energyMatrix[0], &costMatrix[0],
+                            jumpBacktrack ? &seamParents[0] : NULL };
+    kernel::Carried next = cur;
+    if (!inPlaceCarve) {
+        next.energy = incrementalEnergy ? &energyMatrix[1] : cur.energy;
+        next.cost = coneDP ? &costMatrix[1] : cur.cost;
+        next.parents = (coneDP && jumpBacktrack) ? &seamParents[1] : cur.parents;
+    }
 
     int colsRemoved = 0;
 
+    // The buffers are compacted as the image narrows: bufWidth is the width they hold (the
+    // kernels' width) and bufCarved the seams carved since, so the live width is their
+    // difference. compactEvery seams after the last compaction, or once the live width fits a
+    // pitch a quarter narrower, the live columns move into buffers pitched for just them.
+    int bufWidth = width;
+    int bufCarved = 0;
+
     // Events
     //cl::Event blurEvent;
     cl::Event gradientEvent;
@@ -85,7 +182,8 @@ int main(int argc, char** argv) {
     cl::Event backtrackEvent;
     cl::Event carveVertEvent;
 
-    // Dependencies, unused for now.
+    // Each kernel waits on the one before it, the gradient on the previous seam's carve. The
+    // queue is in order anyway, this just keeps it correct if that ever changes.
     std::vector<cl::Event> gradientDeps;
     std::vector<cl::Event> maskUnreachableDeps;
     std::vector<cl::Event> computeSeamsDeps;
@@ -94,21 +192,52 @@ int main(int argc, char** argv) {
     std::vector<cl::Event> carveVertDeps;
 
     // Profiling
-    //cl_ulong blurTimeMicros = 0;
-    cl_ulong gradientTimeMicros = 0;
-    cl_ulong maskUnreachableTimeMicros = 0;
-    cl_ulong computeSeamsTimeMicros = 0;
-    cl_ulong findMinSeamVertTimeMicros = 0;
-    cl_ulong backtrackTimeMicros = 0;
-    cl_ulong carveVertTimeMicros = 0;
-
-    cl_ulong kernelStartTime, kernelEndTime;
+    stats::Stats timing(inputFile, width, height, opts.profiling());
+
+    // Seams are enqueued back to back and the host only waits every syncEvery seams (or at the
+    // end), then harvests the events and readbacks of the whole batch. --compare needs the
+    // image each seam was found in, so it syncs every seam.
+    const int syncEvery = opts.compare ? 1 : opts.syncEvery;
+    std::vector<stats::Launch> batchLaunches[stats::NUM_STAGES];
+    std::vector<cl::Event> computeSeamsLaunches;
+    std::vector<cl::Event> backtrackLaunches;
+    // A slot per seam of the biggest batch, sized up front: the reads into them are still in
+    // flight until the sync, so they can't be reallocated under them
+    const int batchSlots = (syncEvery > 0) ? std::min(syncEvery, colsToRemove) : colsToRemove;
+    std::vector<cl_uint> batchMinCost;
+    std::vector<int> batchSeams;
+    int batchStart = 0;
+    stats::Tick batchTime = stats::tick();
+
+    // Reduced precision bookkeeping
+    int saturatedSeams = 0;
+    int differentSeams = 0;
+    long differentRows = 0;
+    std::vector<unsigned char> hostImage;
+    std::vector<int> hostSeam;
+    FILE *seamLog = 0;
+    if (!opts.seamFile.empty() && !(seamLog = fopen(opts.seamFile.c_str(), "w"))) {
+        std::cerr << "Could not write seams to " << opts.seamFile << std::endl;
+        exit(-1);
+    }
+    if (opts.precision != precision::FLOAT) {
+        batchMinCost.resize(batchSlots);
+    }
+    if (seamLog || opts.compare) {
+        batchSeams.resize((size_t) batchSlots * height);
+    }
 
     // Outer iterator, still need to figure out height
     //while (width > desiredWidth || height > desiredHeight) {
     while (colsRemoved < colsToRemove) {
         std::cout << "Starting iteration:\t#" << colsRemoved << std::endl;
-        uint64 startTime = verify::timeMillis();
+        const int slot = colsRemoved - batchStart;
+
+        gradientDeps.clear();
+        if (colsRemoved > 0) {
+            gradientDeps.push_back(carveVertEvent);
+        }
+        stats::Tick enqueued = stats::tick();
 
         // NOTE: Only one object detection kernel A-C can be left uncommented:
         // Kernel A: Blur image and then compute gradient,
@@ -118,11 +247,25 @@ int main(int argc, char** argv) {
         //             *curInputImage, *curOutputImage,
         //             height, width, colsRemoved);
 
-        kernel::gradient(context, cmdQueue,
-                         gradientEvent, gradientDeps,
-                         *curOutputImage,
-                         energyMatrix,
-                         height, width, colsRemoved);
+        // The fused carve already left this seam's energy in cur.energy
+        const bool carvedEnergy = fusedEnergy && colsRemoved > 0;
+        if (incrementalEnergy && colsRemoved > 0) {
+            // vertSeamPath still holds the seam the last carve took out
+            kernel::gradientSeam(context, cmdQueue,
+                                 gradientEvent, gradientDeps,
+                                 *curInputImage,
+                                 *cur.energy,
+                                 vertSeamPath,
+                                 height, bufWidth, pitch, bufCarved);
+        } else if (!carvedEnergy) {
+            kernel::gradient(context, cmdQueue,
+                             gradientEvent, gradientDeps,
+                             *curInputImage,
+                             *cur.energy,
+                             height, bufWidth, pitch, bufCarved);
+        }
+        // Only the first seam's counts, and that always has a gradient
+        tracer.anchor(gradientEvent, enqueued);
 
         // Kernel B: Convolve with Laplacian of Gaussian:
         //kernel::laplacian(context, cmdQueue, *curInputImage, energyMatrix, sampler, height, width, colsRemoved);
@@ -130,104 +273,250 @@ int main(int argc, char** argv) {
         // Kernel C: Convolve with Optimized Laplacian of Gaussian:
 
 
-        // Mask garbage values from previous iterations as well as stencil artifacts
-        kernel::maskUnreachable(context, cmdQueue,
-                                maskUnreachableEvent, maskUnreachableDeps,
-                                energyMatrix,
-                                width, height, pitch, colsRemoved);
-
-        // Perform dynamic programming top-bottom
-         kernel::computeSeams(context, cmdQueue,
-                             computeSeamsEvent, computeSeamsDeps,
-                             energyMatrix,
-                             width, height, pitch, colsRemoved);
-
-         // Kernel D: Do dynammic programming with Trapezoid (height = 4):
-         //kernel::DP_trapezoidKernel(context, cmdQueue, computeSeamsEvent, computeSeamsDeps, energyMatrix, width, height, pitch, colsRemoved, 4);
-        // Find min vertical seam
-        kernel::findMinSeamVert(context, cmdQueue,
-                                findMinSeamVertEvent, findMinSeamVertDeps,
-                                energyMatrix, vertMinEnergy, vertMinIdx,
-                                width, height, pitch, colsRemoved);
+        // Mask garbage values from previous iterations as well as stencil artifacts. No kernel
+        // reads past the live columns any more, so the incremental and fused energies skip it.
+        if (!incrementalEnergy && !carvedEnergy) {
+            maskUnreachableDeps.assign(1, gradientEvent);
+            kernel::maskUnreachable(context, cmdQueue,
+                                    maskUnreachableEvent, maskUnreachableDeps,
+                                    *cur.energy,
+                                    bufWidth, height, pitch, bufCarved);
+        }
+
+        // Perform dynamic programming top-bottom, or just the part the last seam changed
+        if (carvedEnergy) {
+            computeSeamsDeps.assign(1, carveVertEvent);
+        } else {
+            computeSeamsDeps.assign(1, incrementalEnergy ? gradientEvent : maskUnreachableEvent);
+        }
+        computeSeamsLaunches.clear();
+        if (coneDP && colsRemoved > 0) {
+            kernel::updateSeams(context, cmdQueue,
+                                computeSeamsEvent, computeSeamsDeps,
+                                *cur.energy, *cur.cost, cur.parents, vertSeamPath,
+                                bufWidth, height, pitch, bufCarved, opts.verifyDP,
+                                fusedMin ? &vertMinEnergy : NULL, fusedMin ? &vertMinIdx : NULL);
+            computeSeamsLaunches.push_back(computeSeamsEvent);
+        } else {
+            kernel::computeSeams(context, cmdQueue,
+                                 computeSeamsEvent, computeSeamsDeps,
+                                 *cur.energy, *cur.cost, cur.parents,
+                                 bufWidth, height, pitch, bufCarved,
+                                 &computeSeamsLaunches, opts.verifyDP,
+                                 fusedMin ? &vertMinEnergy : NULL, fusedMin ? &vertMinIdx : NULL);
+        }
+
+        // Find min vertical seam, unless the DP already did
+        if (fusedMin) {
+            backtrackDeps.assign(1, computeSeamsEvent);
+        } else {
+            findMinSeamVertDeps.assign(1, computeSeamsEvent);
+            kernel::findMinSeamVert(context, cmdQueue,
+                                    findMinSeamVertEvent, findMinSeamVertDeps,
+                                    *cur.cost, vertMinEnergy, vertMinIdx,
+                                    bufWidth, height, pitch, bufCarved);
+            backtrackDeps.assign(1, findMinSeamVertEvent);
+        }
 
         // Backtrack
+        backtrackLaunches.clear();
         kernel::backtrack(context, cmdQueue,
                           backtrackEvent, backtrackDeps,
-                          energyMatrix, vertSeamPath, vertMinIdx,
-                          width, height, pitch, colsRemoved);
+                          *cur.cost, vertSeamPath, vertMinIdx,
+                          bufWidth, height, pitch, bufCarved,
+                          cur.parents, seamJumps, &backtrackLaunches);
 
         // for debugging
         //kernel::paintSeam(context, cmdQueue, inputImage, vertSeamPath, width, height);
 
-        kernel::carveVert(context, cmdQueue,
-                          carveVertEvent, carveVertDeps,
-                          *curInputImage, *curOutputImage,
-                          vertSeamPath,
-                          width, height, colsRemoved + 1);
-
-        cmdQueue.flush(); // Is this call needed?
-        cmdQueue.finish();
+        carveVertDeps.assign(1, backtrackEvent);
+        kernel::Carried carried = { incrementalEnergy ? cur.energy : NULL,
+                                    coneDP ? cur.cost : NULL,
+                                    coneDP ? cur.parents : NULL };
+        if (fusedEnergy && colsRemoved + 1 < colsToRemove) {
+            // The DP is done with the energy, so the next seam's goes in the same buffer
+            kernel::carveVertGradient(context, cmdQueue,
+                                      carveVertEvent, carveVertDeps,
+                                      *curInputImage, *curOutputImage,
+                                      vertSeamPath, *cur.energy,
+                                      bufWidth, height, pitch, bufCarved + 1);
+        } else if (inPlaceCarve) {
+            kernel::carveVertInPlace(context, cmdQueue,
+                                     carveVertEvent, carveVertDeps,
+                                     *curInputImage, vertSeamPath,
+                                     bufWidth, height, pitch, bufCarved + 1,
+                                     carried);
+        } else {
+            kernel::carveVert(context, cmdQueue,
+                              carveVertEvent, carveVertDeps,
+                              *curInputImage, *curOutputImage,
+                              vertSeamPath,
+                              bufWidth, height, pitch, bufCarved + 1,
+                              carried, next);
+        }
+
+        if (!carvedEnergy) {
+            batchLaunches[stats::ENERGY].push_back(stats::Launch(gradientEvent, colsRemoved));
+        }
+        if (!incrementalEnergy && !carvedEnergy) {
+            batchLaunches[stats::MASK].push_back(stats::Launch(maskUnreachableEvent, colsRemoved));
+        }
+        for (size_t i = 0; i < computeSeamsLaunches.size(); ++i) {
+            batchLaunches[stats::DP].push_back(stats::Launch(computeSeamsLaunches[i], colsRemoved));
+        }
+        if (!fusedMin) {
+            batchLaunches[stats::FINDMIN].push_back(stats::Launch(findMinSeamVertEvent, colsRemoved));
+        }
+        for (size_t i = 0; i < backtrackLaunches.size(); ++i) {
+            batchLaunches[stats::BACKTRACK].push_back(stats::Launch(backtrackLaunches[i], colsRemoved));
+        }
+        batchLaunches[stats::CARVE].push_back(stats::Launch(carveVertEvent, colsRemoved));
+
+        // The in-order queue runs these before the next seam overwrites the buffers
+        if (!batchMinCost.empty()) {
+            mem::readAsync(context, cmdQueue, &batchMinCost[slot], vertMinEnergy, 1);
+        }
+        if (!batchSeams.empty()) {
+            mem::readAsync(context, cmdQueue, &batchSeams[(size_t) slot * height], vertSeamPath,
+                           height);
+        }
         ++colsRemoved;
+        ++bufCarved;
+
+        if (colsRemoved == colsToRemove || colsRemoved - batchStart == syncEvery) {
+            stats::Tick syncStart = stats::tick();
+            cmdQueue.finish();
+            tracer.host("sync", syncStart, stats::tick());
+
+            for (int i = 0; i < colsRemoved - batchStart; ++i) {
+                const int *deviceSeam = batchSeams.empty() ? 0 : &batchSeams[(size_t) i * height];
+                if (!batchMinCost.empty() && precision::saturated(opts.precision, batchMinCost[i])) {
+                    ++saturatedSeams;
+                }
+                if (seamLog) {
+                    // Same layout as the carves files from ref_images/carve.py
+                    fprintf(seamLog, "%d x %d: ", height, width - batchStart - i);
+                    for (int y = 0; y < height; ++y) {
+                        fprintf(seamLog, "%d ", deviceSeam[y]);
+                    }
+                    fprintf(seamLog, "\n");
+                }
+            }
+            if (opts.compare) {
+                // A batch of one: curInputImage is the image this seam was found in (the carve
+                // wrote curOutputImage)
+                hostImage.resize((size_t) bufWidth * height * 4);
+                mem::readRows(context, cmdQueue, &hostImage[0], *curInputImage, bufWidth * 4, height,
+                              pitch * 4);
+                verify::hostSeam(&hostImage[0], bufWidth, height, bufCarved - 1, hostSeam,
+                                 opts.precision == precision::INT);
+
+                int rows = 0;
+                for (int y = 0; y < height; ++y) {
+                    rows += (batchSeams[y] != hostSeam[y]);
+                }
+                if (rows > 0) {
+                    ++differentSeams;
+                    differentRows += rows;
+                }
+            }
+
+            timing.batch(batchTime, batchLaunches);
+            if (opts.profiling()) {
+                tracer.kernels(batchLaunches);
+            }
+            for (int s = 0; s < stats::NUM_STAGES; ++s) {
+                batchLaunches[s].clear();
+            }
+            batchStart = colsRemoved;
+            batchTime = stats::tick();
+        }
 
         // Swap pointers
         std::swap(curInputImage, curOutputImage);
-
-        totalTimeMillis += (verify::timeMillis() - startTime);
-
-        //blurEvent.getProfilingInfo(CL_PROFILING_COMMAND_START, &kernelStartTime);
-        //blurEvent.getProfilingInfo(CL_PROFILING_COMMAND_END, &kernelEndTime);
-        //blurTimeMicros += (kernelEndTime - kernelStartTime);
-
-        gradientEvent.getProfilingInfo(CL_PROFILING_COMMAND_START, &kernelStartTime);
-        gradientEvent.getProfilingInfo(CL_PROFILING_COMMAND_END, &kernelEndTime);
-        gradientTimeMicros += (kernelEndTime - kernelStartTime);
-
-        maskUnreachableEvent.getProfilingInfo(CL_PROFILING_COMMAND_START, &kernelStartTime);
-        maskUnreachableEvent.getProfilingInfo(CL_PROFILING_COMMAND_END, &kernelEndTime);
-        maskUnreachableTimeMicros += (kernelEndTime - kernelStartTime);
-
-        computeSeamsEvent.getProfilingInfo(CL_PROFILING_COMMAND_START, &kernelStartTime);
-        computeSeamsEvent.getProfilingInfo(CL_PROFILING_COMMAND_END, &kernelEndTime);
-        computeSeamsTimeMicros += (kernelEndTime - kernelStartTime);
-
-        findMinSeamVertEvent.getProfilingInfo(CL_PROFILING_COMMAND_START, &kernelStartTime);
-        findMinSeamVertEvent.getProfilingInfo(CL_PROFILING_COMMAND_END, &kernelEndTime);
-        findMinSeamVertTimeMicros += (kernelEndTime - kernelStartTime);
-
-        backtrackEvent.getProfilingInfo(CL_PROFILING_COMMAND_START, &kernelStartTime);
-        backtrackEvent.getProfilingInfo(CL_PROFILING_COMMAND_END, &kernelEndTime);
-        backtrackTimeMicros += (kernelEndTime - kernelStartTime);
-
-        carveVertEvent.getProfilingInfo(CL_PROFILING_COMMAND_START, &kernelStartTime);
-        carveVertEvent.getProfilingInfo(CL_PROFILING_COMMAND_END, &kernelEndTime);
-        carveVertTimeMicros += (kernelEndTime - kernelStartTime);
+        std::swap(cur, next);
+
+        // Compact what the next seam starts from (the carried matrices), the buffers it fills in
+        // just shrink
+        const int liveWidth = bufWidth - bufCarved;
+        const int livePitch = mem::pitch(device, liveWidth);
+        if (colsRemoved < colsToRemove && livePitch < pitch &&
+            (livePitch <= pitch * 3 / 4 || (opts.compactEvery > 0 && bufCarved >= opts.compactEvery))) {
+            const size_t costBytes = precision::costBytes(opts.precision);
+            // The next seam waits on the compaction, which waits on the carve
+            cl::Event &after = carveVertEvent;
+            mem::repitch(context, cmdQueue, *curInputImage, 4, liveWidth, height, pitch, livePitch,
+                         true, after);
+            if (curOutputImage != curInputImage) {
+                mem::repitch(context, cmdQueue, *curOutputImage, 4, liveWidth, height, pitch,
+                             livePitch, false, after);
+            }
+            mem::repitch(context, cmdQueue, *cur.energy, costBytes, liveWidth, height, pitch,
+                         livePitch, incrementalEnergy || fusedEnergy, after);
+            if (cur.cost != cur.energy && incrementalEnergy) {
+                mem::repitch(context, cmdQueue, *cur.cost, costBytes, liveWidth, height, pitch,
+                             livePitch, coneDP, after);
+            } else {
+                *cur.cost = *cur.energy;
+            }
+            if (next.energy != cur.energy) {
+                mem::repitch(context, cmdQueue, *next.energy, costBytes, liveWidth, height, pitch,
+                             livePitch, false, after);
+            }
+            if (next.cost != cur.cost) {
+                mem::repitch(context, cmdQueue, *next.cost, costBytes, liveWidth, height, pitch,
+                             livePitch, false, after);
+            }
+            if (jumpBacktrack) {
+                mem::repitch(context, cmdQueue, *cur.parents, 1, liveWidth, height, pitch,
+                             livePitch, coneDP, after);
+                if (next.parents != cur.parents) {
+                    mem::repitch(context, cmdQueue, *next.parents, 1, liveWidth, height, pitch,
+                                 livePitch, false, after);
+                }
+                for (int i = 0; i < 2; ++i) {
+                    mem::repitch(context, cmdQueue, seamJumps[i], sizeof(int), liveWidth,
+                                 kernel::backtrackBlocks(height), pitch, livePitch, false, after);
+                }
+            }
+            std::cout << "Compacted to " << liveWidth << " columns, pitch " << livePitch
+                      << std::endl;
+            bufWidth = liveWidth;
+            bufCarved = 0;
+            pitch = livePitch;
+        }
     }
 
-    // Save image to disk.
-    // TODO(amidvidy): this should be saving inputImage
-    //image::save(cmdQueue, *curOutputImage, outputFile, height, width);
-    char *resultCharBuffer = 0;
-    image::saveBuffer(context, cmdQueue, *curOutputImage, outputFile, height, width, resultCharBuffer);
+    // Save image to disk. The last swap left the carved image in curInputImage.
+    //image::save(cmdQueue, *curInputImage, outputFile, height, width);
+    stats::Tick saveStart = stats::tick();
+    image::saveBuffer(context, cmdQueue, *curInputImage, outputFile, height, bufWidth - bufCarved,
+                      pitch);
+    tracer.host("save", saveStart, stats::tick());
 
-
-    // TODO(amidvidy): this debugging code is no longer needed.
-    // std::cout << std::endl;
-    // std::cout << "Checking buffer representation of image..." << std::endl;
-    // if (!verify::arraysEqual(origCharBuffer, resultCharBuffer, height * width * 4)) {
-    //     std::cout << "Arrays do not match!!!" << std::endl;
-    // }
-    delete [] origCharBuffer;
-    delete [] resultCharBuffer;
+    if (seamLog) {
+        fclose(seamLog);
+    }
 
     std::cout << std::endl;
     std::cout << "Carve completed!" << std::endl;
     std::cout << std::endl;
-    std::cout << "Avg total time per iteration:\t" << totalTimeMillis / colsToRemove << " millis" << std::endl;
-    //std::cout << "Avg time for blur:\t" << blurTimeMicros / colsToRemove << " micros" << std::endl;
-    std::cout << "Avg time for gradient:\t" << gradientTimeMicros / colsToRemove << " micros" << std::endl;
-    std::cout << "Avg time for maskUnreachable:\t" << maskUnreachableTimeMicros / colsToRemove << " micros" << std::endl;
-    std::cout << "Avg time for computeSeams\t" << computeSeamsTimeMicros / colsToRemove << " micros" << std::endl;
-    std::cout << "Avg time for findMinSeamVert\t" << findMinSeamVertTimeMicros / colsToRemove << " micros" << std::endl;
-    std::cout << "Avg time for backtrack\t" << backtrackTimeMicros / colsToRemove << " micros" << std::endl;
-    std::cout << "Avg time for carveVert\t" << carveVertTimeMicros / colsToRemove << " micros" << std::endl;
+    if (saturatedSeams > 0) {
+        std::cout << "Cost saturated in " << saturatedSeams << " of " << colsToRemove
+                  << " seams, those seams were picked arbitrarily." << std::endl;
+    }
+    if (opts.compare) {
+        std::cout << precision::name(opts.precision) << " vs host reference: " << differentSeams
+                  << " of " << colsToRemove << " seams differ (" << differentRows << " rows)"
+                  << std::endl;
+    }
+    std::cout << "Avg total time per iteration:\t" << timing.totalNs() * 1e-6 / colsToRemove << " millis" << std::endl;
+    for (int s = 0; opts.profiling() && s < stats::NUM_STAGES; ++s) {
+        std::cout << "Avg time for " << stats::STAGE_NAMES[s] << ":\t"
+                  << timing.stageNs[s] * 1e-3 / colsToRemove << " micros" << std::endl;
+    }
+    if (!opts.statsFormat.empty()) {
+        timing.write(opts.statsFile, opts.statsFormat == "json");
+    }
+    tracer.write(opts.traceFile);
 }
@@ -1,26 +1,493 @@
 #ifndef SETUP_HPP
 #define SETUP_HPP
 
+// C
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// POSIX
+#include <sys/stat.h>
+#include <unistd.h>
+
+// STL
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
 // OpenCL
 #include <CL/cl.hpp>
 
+// SeamCL
+#include "precision.hpp"
+
 // Functions relating to configuring openCL objects
 namespace setup {
 
+    // Optional flags, given before or after the positional arguments.
+    struct Options {
+        precision::Mode precision;
+        bool compare;
+        std::string statsFormat; // "json", "csv" or empty for none
+        std::string statsFile;   // empty for stdout
+        std::string seamFile;    // every seam, in the ref_images carves format
+        bool verifyDP;
+        std::string dp;          // DP kernel: auto, global, local or tiled, see kernel::computeSeams()
+        std::string backtrack;   // auto, serial or jump, see kernel::jumpBacktrack()
+        std::string energy;      // incremental (carry the energy over, patch the seam), fused
+                                 // (the carve recomputes it) or full
+        std::string dpUpdate;    // cone (carry the costs over, redo what changed) or full
+        std::string findMin;     // fused (the DP finds the seam's min) or separate
+        std::string carve;       // inplace or copy (into the other image buffer)
+        int compactEvery;        // seams between compactions, 0 for only when it saves enough
+        std::string device;      // type, name or index, see selectDevice()
+        bool benchDevices;       // time every matching device, keep the fastest
+        int syncEvery;           // seams enqueued between host syncs, 0 for only at the end
+        std::string traceFile;   // Chrome trace of every kernel, empty for none
+        bool profile;            // per-kernel times, implied by --stats and --trace
+        bool autotune;           // sweep the work group sizes before carving, see tune.hpp
+        std::string tuneProfile; // tuned sizes, default <kernel cache>/<device>.tune
+
+        Options() : precision(precision::FLOAT), compare(false), verifyDP(false), dp("auto"),
+                    backtrack("auto"), energy("incremental"),
+                    dpUpdate("cone"), findMin("fused"), carve("inplace"), compactEvery(0), benchDevices(false),
+                    syncEvery(0), profile(false), autotune(false) {}
+
+        // Whether the queue needs CL_QUEUE_PROFILING_ENABLE
+        bool profiling() const {
+            return profile || !statsFormat.empty() || !traceFile.empty();
+        }
+    };
+
+    void usage() {
+        std::cerr << "USAGE: seamcl [OPTIONS] <INPUT> <OUTPUT> <COLS_TO_REMOVE>" << std::endl;
+        std::cerr << "OPTIONS:" << std::endl;
+        std::cerr << "  --precision=float|fixed|half|int" << std::endl;
+        std::cerr << "                                energy/cost storage: 32 bit float (default), "
+                  << "uint32 saturating fixed point, fp16, or integer energy (bit exact with "
+                  << "the host reference and seamc --precision=int)" << std::endl;
+        std::cerr << "  --compare                     check every seam against the host reference "
+                  << "and report how many differ" << std::endl;
+        std::cerr << "  --stats=json|csv              per-kernel timings, csv uses the "
+                  << "andromeda.csv columns" << std::endl;
+        std::cerr << "  --stats-out=<FILE>            write the stats to a file rather than "
+                  << "stdout" << std::endl;
+        std::cerr << "  --profile                     report the average time of each kernel "
+                  << "(implied by --stats and --trace, off otherwise to skip the profiling "
+                  << "overhead)" << std::endl;
+        std::cerr << "  --trace=<FILE>                write a Chrome trace (chrome://tracing, "
+                  << "ui.perfetto.dev) of every kernel and the main host steps" << std::endl;
+        std::cerr << "  --dump-seams=<FILE>           write every seam to a file, one line per "
+                  << "seam as in ref_images/*/carves" << std::endl;
+        std::cerr << "  --verify-dp                   check the DP against the host every "
+                  << "iteration (float only)" << std::endl;
+        std::cerr << "  --dp=auto|global|local|tiled  DP kernel: trapezoid tiles over every compute "
+                  << "unit, one work group with the rows in local memory, or one work group "
+                  << "through global memory (default auto, picks in that order)" << std::endl;
+        std::cerr << "  --backtrack=auto|serial|jump  find the seam with one walker or by pointer "
+                  << "jumping over row blocks (default auto, jumps on tall images)" << std::endl;
+        std::cerr << "  --energy=incremental|fused|full" << std::endl;
+        std::cerr << "                                carry the energy over from the last seam "
+                  << "and recompute only the pixels around it (default), compute it all in the "
+                  << "carve's pass over the image, or in a pass of its own every seam" << std::endl;
+        std::cerr << "  --dp-update=cone|full         carry the costs over from the last seam and "
+                  << "redo only the cone below it that changed (default, needs the incremental "
+                  << "energy), or the whole DP every seam" << std::endl;
+        std::cerr << "  --find-min=fused|separate     find the seam's min as the DP fills the last "
+                  << "row (default), or in a launch of its own" << std::endl;
+        std::cerr << "  --carve=inplace|copy          shift the pixels right of the seam within "
+                  << "the image (default), or copy the whole image into a second buffer every "
+                  << "seam (always with --energy=fused and --compare)" << std::endl;
+        std::cerr << "  --compact-every=<N>           move the live columns into narrower buffers "
+                  << "every N seams as well as whenever the live width fits a quarter narrower "
+                  << "pitch (default 0, only then)" << std::endl;
+        std::cerr << "  --sync-every=<N>              wait for the device every N seams rather "
+                  << "than only at the end (--compare syncs every seam)" << std::endl;
+        std::cerr << "  --device=<DEVICE>             gpu, cpu, accelerator, all, a platform or "
+                  << "device name (substring), a device index or <platform>:<device>. Defaults "
+                  << "to $SEAMCL_DEVICE, then the first gpu, then anything available" << std::endl;
+        std::cerr << "  --bench-devices               run a short benchmark on every matching "
+                  << "device and use the fastest (or set SEAMCL_BENCH_DEVICES=1)" << std::endl;
+        std::cerr << "  --autotune                    time every legal work group size of each "
+                  << "kernel on this image and save the fastest to the tuning profile" << std::endl;
+        std::cerr << "  --tune-profile=<FILE>         tuned work group sizes, default "
+                  << "<kernel cache>/<device>.tune" << std::endl;
+        std::cerr << "  --kernel-cache=<DIR>          where compiled kernels are kept, default "
+                  << "$SEAMCL_CACHE_DIR or ~/.cache/seamcl" << std::endl;
+        std::cerr << "  --no-kernel-cache             always compile the kernels from source"
+                  << std::endl;
+        std::cerr << "  --list-devices                list the devices and their indices, then "
+                  << "exit" << std::endl;
+    }
+
+    // Directory for compiled program binaries, empty to always compile. Set by args().
+    std::string kernelCache;
+
+    // A device and the platform it belongs to
+    struct Candidate {
+        cl::Platform platform;
+        cl::Device device;
+        int platformIdx, deviceIdx;
+    };
+
+    std::string lower(std::string s) {
+        for (size_t i = 0; i < s.size(); ++i) {
+            s[i] = std::tolower((unsigned char) s[i]);
+        }
+        return s;
+    }
+
+    const char *typeName(cl_device_type type) {
+        if (type & CL_DEVICE_TYPE_GPU) return "gpu";
+        if (type & CL_DEVICE_TYPE_CPU) return "cpu";
+        if (type & CL_DEVICE_TYPE_ACCELERATOR) return "accelerator";
+        return "other";
+    }
+
+    /**
+     * Every available device on every platform, in platform order.
+     */
+    std::vector<Candidate> candidates() {
+        std::vector<Candidate> all;
+        std::vector<cl::Platform> platformList;
+        if (cl::Platform::get(&platformList) != CL_SUCCESS) {
+            return all;
+        }
+        for (size_t p = 0; p < platformList.size(); ++p) {
+            std::vector<cl::Device> devices;
+            if (platformList[p].getDevices(CL_DEVICE_TYPE_ALL, &devices) != CL_SUCCESS) {
+                continue;
+            }
+            for (size_t d = 0; d < devices.size(); ++d) {
+                if (!devices[d].getInfo<CL_DEVICE_AVAILABLE>()) {
+                    continue;
+                }
+                Candidate c = { platformList[p], devices[d], (int) p, (int) d };
+                all.push_back(c);
+            }
+        }
+        return all;
+    }
+
+    void listDevices() {
+        std::vector<Candidate> all = candidates();
+        if (all.empty()) {
+            std::cout << "No OpenCL devices found." << std::endl;
+        }
+        for (size_t i = 0; i < all.size(); ++i) {
+            std::cout << i << " (" << all[i].platformIdx << ":" << all[i].deviceIdx << ")\t"
+                      << typeName(all[i].device.getInfo<CL_DEVICE_TYPE>()) << "\t"
+                      << all[i].device.getInfo<CL_DEVICE_NAME>() << "\t["
+                      << all[i].platform.getInfo<CL_PLATFORM_NAME>() << "]" << std::endl;
+        }
+    }
+
+    /**
+     * The devices matching a --device spec: a type (gpu, cpu, accelerator, all), an index
+     * into candidates(), <platform>:<device>, or a case insensitive substring of the device or
+     * platform name.
+     */
+    std::vector<Candidate> match(const std::vector<Candidate> &all, const std::string &spec) {
+        std::vector<Candidate> found;
+        const std::string want = lower(spec);
+        cl_device_type type = 0;
+        if (want == "gpu") type = CL_DEVICE_TYPE_GPU;
+        else if (want == "cpu") type = CL_DEVICE_TYPE_CPU;
+        else if (want == "accelerator") type = CL_DEVICE_TYPE_ACCELERATOR;
+        else if (want == "all" || want == "any") type = CL_DEVICE_TYPE_ALL;
+
+        int idx = -1, platformIdx = -1, deviceIdx = -1;
+        char tail;
+        const bool isIndex = (sscanf(want.c_str(), "%d%c", &idx, &tail) == 1);
+        const bool isPair = (sscanf(want.c_str(), "%d:%d%c", &platformIdx, &deviceIdx, &tail) == 2);
+
+        for (size_t i = 0; i < all.size(); ++i) {
+            const Candidate &c = all[i];
+            bool ok;
+            if (type) {
+                ok = (c.device.getInfo<CL_DEVICE_TYPE>() & type) != 0;
+            } else if (isIndex) {
+                ok = ((int) i == idx);
+            } else if (isPair) {
+                ok = (c.platformIdx == platformIdx && c.deviceIdx == deviceIdx);
+            } else {
+                ok = lower(c.device.getInfo<CL_DEVICE_NAME>()).find(want) != std::string::npos ||
+                     lower(c.platform.getInfo<CL_PLATFORM_NAME>()).find(want) != std::string::npos;
+            }
+            if (ok) {
+                found.push_back(c);
+            }
+        }
+        return found;
+    }
+
+    // One DP-like pass (three way min down the rows) sized so launch overhead doesn't dominate
+    const char *BENCH_SOURCE =
+        "__kernel void bench(__global float *m, int width, int height) {\n"
+        "    int x = get_global_id(0);\n"
+        "    for (int y = 1; y < height; ++y) {\n"
+        "        int l = max(x - 1, 0), r = min(x + 1, width - 1);\n"
+        "        __global float *prev = m + (y - 1) * width;\n"
+        "        m[y * width + x] += min(prev[x], min(prev[l], prev[r]));\n"
+        "        barrier(CLK_GLOBAL_MEM_FENCE);\n"
+        "    }\n"
+        "}\n";
+
+    /**
+     * Best of three runs of BENCH_SOURCE on one device, in ms, or a negative value if the device
+     * could not run it.
+     */
+    double benchDevice(const Candidate &c) {
+        const int width = 256, height = 2048;
+        cl_int err;
+        cl::Context ctx(c.device, 0, 0, 0, &err);
+        if (err != CL_SUCCESS) return -1.0;
+        cl::CommandQueue queue(ctx, c.device, 0, &err);
+        if (err != CL_SUCCESS) return -1.0;
+
+        cl::Program::Sources sources;
+        sources.push_back(std::make_pair(BENCH_SOURCE, strlen(BENCH_SOURCE)));
+        cl::Program program(ctx, sources, &err);
+        if (err != CL_SUCCESS) return -1.0;
+        std::vector<cl::Device> devices(1, c.device);
+        if (program.build(devices) != CL_SUCCESS) return -1.0;
+        cl::Kernel bench(program, "bench", &err);
+        if (err != CL_SUCCESS) return -1.0;
+
+        std::vector<float> host(width * height, 1.0f);
+        cl::Buffer m(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, host.size() * sizeof(float),
+                     &host[0], &err);
+        if (err != CL_SUCCESS) return -1.0;
+        bench.setArg(0, m);
+        bench.setArg(1, width);
+        bench.setArg(2, height);
+
+        // A single work group so the barrier orders the rows, as in the real DP
+        size_t local = std::min((size_t) width, c.device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>());
+        double best = -1.0;
+        // The first run also pays for any lazy compilation, so it is only a warm up
+        for (int run = 0; run < 4; ++run) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (queue.enqueueNDRangeKernel(bench, cl::NullRange, cl::NDRange(local),
+                                           cl::NDRange(local)) != CL_SUCCESS ||
+                queue.finish() != CL_SUCCESS) {
+                return -1.0;
+            }
+            double ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+            if (run > 0 && (best < 0 || ms < best)) {
+                best = ms;
+            }
+        }
+        return best;
+    }
+
+    /**
+     * Picks the device to run on. An explicit spec that matches nothing falls back to the default
+     * order (first gpu, then anything), so a job written for a GPU node still runs on a CPU-only
+     * one, just slower.
+     */
+    Candidate selectDevice(const Options &opts) {
+        std::vector<Candidate> all = candidates();
+        if (all.empty()) {
+            std::cerr << "No OpenCL devices found." << std::endl;
+            exit(-1);
+        }
+
+        std::vector<Candidate> found;
+        if (!opts.device.empty()) {
+            found = match(all, opts.device);
+            if (found.empty()) {
+                std::cerr << "No OpenCL device matches '" << opts.device
+                          << "', falling back to the default." << std::endl;
+            }
+        }
+        if (found.empty()) {
+            found = match(all, "gpu");
+            if (found.empty()) {
+                std::cerr << "No OpenCL GPU found, using "
+                          << all[0].device.getInfo<CL_DEVICE_NAME>() << "." << std::endl;
+                found = all;
+            }
+        }
+
+        if (!opts.benchDevices || found.size() == 1) {
+            return found[0];
+        }
+
+        int bestIdx = -1;
+        double bestMs = 0.0;
+        for (size_t i = 0; i < found.size(); ++i) {
+            double ms = benchDevice(found[i]);
+            std::cout << "Device bench: " << found[i].device.getInfo<CL_DEVICE_NAME>() << " ";
+            if (ms < 0) {
+                std::cout << "failed" << std::endl;
+                continue;
+            }
+            std::cout << ms << " ms" << std::endl;
+            if (bestIdx < 0 || ms < bestMs) {
+                bestIdx = (int) i;
+                bestMs = ms;
+            }
+        }
+        return found[bestIdx < 0 ? 0 : bestIdx];
+    }
+
     void args(int argc, char** argv,
               std::string &inputFile,
               std::string &outputFile,
-              int &colsToRemove) {
-        if (argc < 4) {
-            std::cerr << "USAGE: seamcl <INPUT> <OUTPUT> <COLS_TO_REMOVE>" << std::endl;
+              int &colsToRemove,
+              Options &opts) {
+        // Pull out the flags, leaving just the positional args
+        std::vector<char*> positional;
+        bool cacheSet = false;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg(argv[i]);
+            if (arg.compare(0, 2, "--") != 0) {
+                positional.push_back(argv[i]);
+            } else if (arg.compare(0, 12, "--precision=") == 0) {
+                if (!precision::parse(arg.substr(12), opts.precision)) {
+                    std::cerr << "Unknown precision: " << arg.substr(12) << std::endl;
+                    usage();
+                    exit(-1);
+                }
+            } else if (arg == "--compare") {
+                opts.compare = true;
+            } else if (arg.compare(0, 8, "--stats=") == 0) {
+                opts.statsFormat = arg.substr(8);
+                if (opts.statsFormat != "json" && opts.statsFormat != "csv") {
+                    std::cerr << "Unknown stats format: " << opts.statsFormat << std::endl;
+                    usage();
+                    exit(-1);
+                }
+            } else if (arg.compare(0, 12, "--stats-out=") == 0) {
+                opts.statsFile = arg.substr(12);
+            } else if (arg == "--profile") {
+                opts.profile = true;
+            } else if (arg.compare(0, 8, "--trace=") == 0) {
+                opts.traceFile = arg.substr(8);
+            } else if (arg.compare(0, 13, "--dump-seams=") == 0) {
+                opts.seamFile = arg.substr(13);
+            } else if (arg == "--verify-dp") {
+                opts.verifyDP = true;
+            } else if (arg.compare(0, 5, "--dp=") == 0) {
+                opts.dp = arg.substr(5);
+                if (opts.dp != "auto" && opts.dp != "global" && opts.dp != "local" && opts.dp != "tiled") {
+                    std::cerr << "Unknown DP kernel: " << opts.dp << std::endl;
+                    usage();
+                    exit(-1);
+                }
+            } else if (arg.compare(0, 12, "--backtrack=") == 0) {
+                opts.backtrack = arg.substr(12);
+                if (opts.backtrack != "auto" && opts.backtrack != "serial" && opts.backtrack != "jump") {
+                    std::cerr << "Unknown backtrack: " << opts.backtrack << std::endl;
+                    usage();
+                    exit(-1);
+                }
+            } else if (arg.compare(0, 9, "--energy=") == 0) {
+                opts.energy = arg.substr(9);
+                if (opts.energy != "incremental" && opts.energy != "fused" &&
+                    opts.energy != "full") {
+                    std::cerr << "Unknown energy: " << opts.energy << std::endl;
+                    usage();
+                    exit(-1);
+                }
+            } else if (arg.compare(0, 12, "--dp-update=") == 0) {
+                opts.dpUpdate = arg.substr(12);
+                if (opts.dpUpdate != "cone" && opts.dpUpdate != "full") {
+                    std::cerr << "Unknown DP update: " << opts.dpUpdate << std::endl;
+                    usage();
+                    exit(-1);
+                }
+            } else if (arg.compare(0, 11, "--find-min=") == 0) {
+                opts.findMin = arg.substr(11);
+                if (opts.findMin != "fused" && opts.findMin != "separate") {
+                    std::cerr << "Unknown find-min: " << opts.findMin << std::endl;
+                    usage();
+                    exit(-1);
+                }
+            } else if (arg.compare(0, 8, "--carve=") == 0) {
+                opts.carve = arg.substr(8);
+                if (opts.carve != "inplace" && opts.carve != "copy") {
+                    std::cerr << "Unknown carve: " << opts.carve << std::endl;
+                    usage();
+                    exit(-1);
+                }
+            } else if (arg.compare(0, 16, "--compact-every=") == 0) {
+                std::istringstream n(arg.substr(16));
+                if (!(n >> opts.compactEvery) || opts.compactEvery < 0) {
+                    std::cerr << "--compact-every takes a number of seams, 0 to compact only "
+                              << "when it saves a quarter of the pitch." << std::endl;
+                    exit(-1);
+                }
+            } else if (arg.compare(0, 13, "--sync-every=") == 0) {
+                std::istringstream n(arg.substr(13));
+                if (!(n >> opts.syncEvery) || opts.syncEvery < 0) {
+                    std::cerr << "--sync-every takes a number of seams, 0 for none." << std::endl;
+                    exit(-1);
+                }
+            } else if (arg.compare(0, 9, "--device=") == 0) {
+                opts.device = arg.substr(9);
+            } else if (arg == "--bench-devices") {
+                opts.benchDevices = true;
+            } else if (arg == "--autotune") {
+                opts.autotune = true;
+            } else if (arg.compare(0, 15, "--tune-profile=") == 0) {
+                opts.tuneProfile = arg.substr(15);
+            } else if (arg.compare(0, 15, "--kernel-cache=") == 0) {
+                kernelCache = arg.substr(15);
+                cacheSet = true;
+            } else if (arg == "--no-kernel-cache") {
+                kernelCache.clear();
+                cacheSet = true;
+            } else if (arg == "--list-devices") {
+                listDevices();
+                exit(0);
+            } else {
+                std::cerr << "Unknown option: " << arg << std::endl;
+                usage();
+                exit(-1);
+            }
+        }
+
+        // The environment only fills in what the flags left unset
+        const char *env = getenv("SEAMCL_DEVICE");
+        if (opts.device.empty() && env) {
+            opts.device = env;
+        }
+        if (!cacheSet) {
+            if ((env = getenv("SEAMCL_CACHE_DIR"))) {
+                kernelCache = env;
+            } else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+                kernelCache = std::string(env) + "/seamcl";
+            } else if ((env = getenv("HOME")) && *env) {
+                kernelCache = std::string(env) + "/.cache/seamcl";
+            }
+        }
+        env = getenv("SEAMCL_BENCH_DEVICES");
+        if (env && *env && std::string(env) != "0") {
+            opts.benchDevices = true;
+        }
+
+        if (opts.verifyDP && opts.precision != precision::FLOAT) {
+            std::cerr << "--verify-dp only checks the float DP, ignoring it." << std::endl;
+            opts.verifyDP = false;
+        }
+
+        if (positional.size() < 3) {
+            usage();
             exit(-1);
         }
 
         // Parse arguments
-        inputFile = std::string(argv[1]);
-        outputFile = std::string(argv[2]);
+        inputFile = std::string(positional[0]);
+        outputFile = std::string(positional[1]);
 
-        std::istringstream s1(argv[3]);
+        std::istringstream s1(positional[2]);
         if (! (s1 >> colsToRemove)) {
             std::cerr << "COLS_TO_REMOVE must be an integer." << std::endl;
             exit(-1);
@@ -28,25 +495,28 @@ namespace setup {
     }
 
 
-    // TODO(amidvidy): error handling
-
     /**
-     * Creates an openCL context. The current preference is for a gpu context. In the future,
-     * it would be nice to give the user the option to interactively select which context they
-     * would like to use.
+     * Creates an openCL context on the single device picked by selectDevice().
+     * @param opts The parsed options, for --device and --bench-devices.
      * @return An openCL context object.
      */
-    cl::Context context() {
-        std::vector<cl::Platform> platformList;
-        cl::Platform::get(&platformList);
+    cl::Context context(const Options &opts) {
+        Candidate chosen = selectDevice(opts);
 
         cl_context_properties cprops[] = {
             CL_CONTEXT_PLATFORM,
-            (cl_context_properties)(platformList[0])(),
+            (cl_context_properties)(chosen.platform)(),
             0
         };
+        cl_int errNum;
         // OK since cl objects are ref counted.
-        return cl::Context(CL_DEVICE_TYPE_GPU, cprops);
+        cl::Context ctx(chosen.device, cprops, 0, 0, &errNum);
+        if (errNum != CL_SUCCESS) {
+            std::cerr << "Failed to create a context on "
+                      << chosen.device.getInfo<CL_DEVICE_NAME>() << std::endl;
+            exit(-1);
+        }
+        return ctx;
     }
 
     // TODO(amidvidy): error handling
@@ -54,15 +524,17 @@ namespace setup {
     /**
      * Creates an openCL command queue.
      * @param ctx An openCL context object.
+     * @param profiling Enables the event timestamps stats and trace use; off otherwise, as it
+     *                  costs a little on every enqueue.
      * @return An openCL command queue object.
      */
-    cl::CommandQueue commandQueue(const cl::Context &ctx) {
+    cl::CommandQueue commandQueue(const cl::Context &ctx, bool profiling) {
         std::vector<cl::Device> devices = ctx.getInfo<CL_CONTEXT_DEVICES>();
 
         // DEBUGGING
         for (size_t i = 0; i < devices.size(); ++i) {
             cl::Device &device = devices[i];
-            std::cout << "Info for device #" << 0 << ":" << std::endl;
+            std::cout << "Info for device #" << i << ":" << std::endl;
             std::cout << "\tName:\t"
                       << device.getInfo<CL_DEVICE_NAME>() << std::endl;
             std::cout << "\tVendor:\t"
@@ -79,59 +551,273 @@ namespace setup {
                       << device.getInfo<CL_DEVICE_EXTENSIONS>() << std::endl;
         }
 
-        return cl::CommandQueue(ctx, devices[0], CL_QUEUE_PROFILING_ENABLE);
+        return cl::CommandQueue(ctx, devices[0], profiling ? CL_QUEUE_PROFILING_ENABLE : 0);
+    }
+
+    // Kernel sources compiled into the binary by the Makefile, so the program text (and the
+    // cache key) never depends on the working directory
+    struct EmbeddedSource {
+        const char *name;
+        const char *text;
+    };
+
+    const EmbeddedSource EMBEDDED_SOURCES[] = {
+#include "clsources.hpp"
+        { 0, 0 }
+    };
+
+    /**
+     * The text of a kernel file, from EMBEDDED_SOURCES if it is there, otherwise read from the
+     * working directory (handy while editing a kernel without rebuilding).
+     */
+    std::string source(const std::string &fileName) {
+        for (const EmbeddedSource *e = EMBEDDED_SOURCES; e->name; ++e) {
+            if (fileName == e->name) {
+                return std::string(e->text);
+            }
+        }
+        std::ifstream file(fileName.c_str());
+        if (!file) {
+            std::cerr << "Could not find kernel source " << fileName << std::endl;
+            exit(-1);
+        }
+        return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    }
+
+    // 64 bit FNV-1a, plenty to tell program texts apart
+    cl_ulong hash(const std::string &text, cl_ulong h = 14695981039346656037ULL) {
+        for (size_t i = 0; i < text.size(); ++i) {
+            h = (h ^ (unsigned char) text[i]) * 1099511628211ULL;
+        }
+        return h;
+    }
+
+    // A device name with everything but letters and digits replaced, for use in file names
+    std::string fileSafe(std::string name) {
+        for (size_t i = 0; i < name.size(); ++i) {
+            if (!isalnum((unsigned char) name[i])) {
+                name[i] = '_';
+            }
+        }
+        return name;
+    }
+
+    /**
+     * Cache file for a program: the device name (for humans) and a hash of everything that
+     * changes the binary, i.e. the device, its driver, the build options and the source.
+     * Empty if the cache is off.
+     */
+    std::string cachePath(const cl::Device &device, const std::string &programText,
+                          const std::string &buildOptions) {
+        if (kernelCache.empty()) {
+            return std::string();
+        }
+        std::string name = device.getInfo<CL_DEVICE_NAME>();
+        cl_ulong h = hash(name);
+        h = hash("\n" + device.getInfo<CL_DRIVER_VERSION>(), h);
+        h = hash("\n" + device.getInfo<CL_DEVICE_VERSION>(), h);
+        h = hash("\n" + buildOptions + "\n", h);
+        h = hash(programText, h);
+
+        char key[17];
+        snprintf(key, sizeof(key), "%016llx", (unsigned long long) h);
+        return kernelCache + "/" + fileSafe(name) + "-" + key + ".bin";
+    }
+
+    /**
+     * Builds a program from a cached binary. Returns false (and the caller compiles from
+     * source) if there is no cache entry or the driver rejects it.
+     */
+    bool loadBinary(cl::Context &ctx, const std::vector<cl::Device> &devices,
+                    const std::string &path, const std::string &buildOptions,
+                    cl::Program &program) {
+        if (path.empty()) {
+            return false;
+        }
+        std::ifstream file(path.c_str(), std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        std::string binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (binary.empty()) {
+            return false;
+        }
+
+        cl::Program::Binaries binaries(1, std::make_pair((const void *) binary.data(), binary.size()));
+        std::vector<cl_int> status;
+        cl_int errNum;
+        program = cl::Program(ctx, devices, binaries, &status, &errNum);
+        if (errNum != CL_SUCCESS || status.empty() || status[0] != CL_SUCCESS) {
+            std::cerr << "Ignoring stale kernel cache entry " << path << std::endl;
+            return false;
+        }
+        return program.build(devices, buildOptions.c_str()) == CL_SUCCESS;
+    }
+
+    // mkdir -p
+    bool makeDirs(const std::string &dir) {
+        for (size_t slash = dir.find('/', 1); ; slash = dir.find('/', slash + 1)) {
+            std::string part = dir.substr(0, slash);
+            if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) {
+                return false;
+            }
+            if (slash == std::string::npos) {
+                return true;
+            }
+        }
+    }
+
+    /**
+     * Writes a freshly built program's binary to the cache. Failure only costs the next run a
+     * compile, so it is silent.
+     */
+    void saveBinary(const cl::Program &program, const std::string &path) {
+        if (path.empty() || !makeDirs(kernelCache)) {
+            return;
+        }
+        std::vector<size_t> sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+        if (sizes.size() != 1 || sizes[0] == 0) {
+            return;
+        }
+        std::vector<char> binary(sizes[0]);
+        std::vector<char*> binaries(1, &binary[0]);
+        if (program.getInfo(CL_PROGRAM_BINARIES, &binaries) != CL_SUCCESS) {
+            return;
+        }
+        // Write then rename, so a concurrent run never loads half a binary
+        std::ostringstream tmp;
+        tmp << path << "." << getpid() << ".tmp";
+        std::ofstream out(tmp.str().c_str(), std::ios::binary);
+        out.write(&binary[0], binary.size());
+        out.close();
+        if (!out || rename(tmp.str().c_str(), path.c_str()) != 0) {
+            remove(tmp.str().c_str());
+        }
+    }
+
+    /**
+     * A program being built. The driver calls buildDone() from its own thread when an
+     * asynchronous build finishes; finishBuild() blocks until then.
+     */
+    struct ProgramBuild {
+        std::string name;          // for error messages
+        std::string cacheFile;
+        cl::Program program;
+        std::vector<cl::Device> devices;
+        bool started, finished, fromCache;
+        std::mutex lock;
+        std::condition_variable done;
+
+        ProgramBuild() : started(false), finished(false), fromCache(false) {}
+    };
+
+    void buildDone(cl_program, void *data) {
+        ProgramBuild *build = (ProgramBuild *) data;
+        std::lock_guard<std::mutex> hold(build->lock);
+        build->finished = true;
+        build->done.notify_all();
     }
 
     /**
-     * Creates an openCL kernel object. This actually involves three separate steps that can each fail,
-     * reading the text of the file from the OS filesystem, creating an openCL program object, and finally
-     * compiling the kernel for each available device.
+     * Starts building a program, from the kernel cache if it has a binary for this device and
+     * source, otherwise by compiling the source. With async the compile runs in the driver while
+     * the caller gets on with something else, so build must stay alive until finishBuild().
      * @param ctx An openCL context object.
-     * @param fileName The name of the file containing the kernel source.
-     * @return An OpenCL kernel object.
+     * @param programText The full source, prelude included.
+     * @param name Names the program in error messages.
      */
-    cl::Kernel kernel(cl::Context &ctx, std::string fileName, std::string kernelFunc) {
-        std::ifstream file(fileName.c_str());
-        std::string programText((std::istreambuf_iterator<char>(file)),
-                                std::istreambuf_iterator<char>());
+    void startBuild(ProgramBuild &build, cl::Context &ctx, const std::string &programText,
+                    const std::string &name, bool async) {
+        const std::string buildOptions;
+        build.name = name;
+        build.devices = ctx.getInfo<CL_CONTEXT_DEVICES>();
+        build.cacheFile = cachePath(build.devices[0], programText, buildOptions);
+        build.started = true;
+        build.finished = false;
+
+        if (loadBinary(ctx, build.devices, build.cacheFile, buildOptions, build.program)) {
+            build.fromCache = build.finished = true;
+            return;
+        }
 
         cl::Program::Sources sources;
         // add one to size for null terminator
         sources.push_back(std::make_pair(programText.c_str(), programText.size() + 1));
 
         cl_int errNum;
-
-        cl::Program program = cl::Program(ctx,
-                                          sources,
-                                          &errNum);
+        build.program = cl::Program(ctx, sources, &errNum);
 
         if (errNum != CL_SUCCESS) {
             std::cerr << "Failed to create CL program from source." << std::endl;
             exit(-1);
         }
 
-        std::vector<cl::Device> devices = ctx.getInfo<CL_CONTEXT_DEVICES>();
-        // TODO(amidvidy): figure out how to reuse the device vector we created earlier?
-        errNum = program.build(ctx.getInfo<CL_CONTEXT_DEVICES>());
+        errNum = build.program.build(build.devices, buildOptions.c_str(),
+                                     async ? buildDone : 0, async ? &build : 0);
+        if (!async || errNum != CL_SUCCESS) {
+            // Either done already or failed before the compile started, finishBuild() says which
+            std::lock_guard<std::mutex> hold(build.lock);
+            build.finished = true;
+        }
+    }
 
-        if (errNum != CL_SUCCESS) {
-            std::cerr << "Failed to compile program." << std::endl;
+    /**
+     * Waits for startBuild() to finish, exits with the build log if it failed and caches the
+     * binary if it was compiled from source.
+     */
+    cl::Program &finishBuild(ProgramBuild &build) {
+        {
+            std::unique_lock<std::mutex> hold(build.lock);
+            while (!build.finished) {
+                build.done.wait(hold);
+            }
+        }
+
+        cl_build_status status =
+            build.program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(build.devices[0]);
+        if (status != CL_BUILD_SUCCESS) {
+            std::cerr << "Failed to compile program " << build.name << "." << std::endl;
             std::string buildLog;
-            program.getBuildInfo(devices[0], (cl_program_build_info) CL_PROGRAM_BUILD_LOG, &buildLog);
+            build.program.getBuildInfo(build.devices[0], (cl_program_build_info) CL_PROGRAM_BUILD_LOG,
+                                       &buildLog);
             std::cerr << buildLog;
             exit(-1);
         }
+        if (!build.fromCache) {
+            saveBinary(build.program, build.cacheFile);
+            build.fromCache = true;
+        }
+        return build.program;
+    }
 
-
+    /**
+     * Creates an openCL kernel object from a built program.
+     */
+    cl::Kernel kernel(const cl::Program &program, const std::string &kernelFunc) {
+        cl_int errNum;
         cl::Kernel kernel = cl::Kernel(program, kernelFunc.c_str(), &errNum);
 
         if (errNum != CL_SUCCESS) {
-            std::cerr << "Failed to create kernel" << std::endl;
+            std::cerr << "Failed to create kernel " << kernelFunc << std::endl;
             exit(-1);
         }
 
         return kernel;
+    }
 
+    /**
+     * Creates an openCL kernel object from a single file, building it synchronously. For kernels
+     * that are only built on demand; the per-seam ones come from kernel::startBuild().
+     * @param ctx An openCL context object.
+     * @param fileName The name of the file containing the kernel source.
+     * @param prelude Source prepended to the file, e.g. precision::prelude().
+     * @return An OpenCL kernel object.
+     */
+    cl::Kernel kernel(cl::Context &ctx, std::string fileName, std::string kernelFunc,
+                      const std::string &prelude = std::string()) {
+        ProgramBuild build;
+        startBuild(build, ctx, prelude + source(fileName), fileName, false);
+        return kernel(finishBuild(build), kernelFunc);
     }
 
 
@@ -0,0 +1,201 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+// C
+#include <cstdio>
+#include <cstdlib>
+
+// STL
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// OpenCL
+#include <CL/cl.hpp>
+
+// Per-kernel timings, written in the same shape as seamc --stats so the two line up in
+// andromeda.csv. Kernel times come from the profiling events, iteration times are host wall
+// clock (so they include launch overhead and any readback), see batch().
+namespace stats {
+
+    enum Stage { ENERGY, MASK, DP, FINDMIN, BACKTRACK, CARVE, NUM_STAGES };
+
+    const char *STAGE_NAMES[NUM_STAGES] = { "energy", "mask", "dp", "findmin", "backtrack", "carve" };
+
+    typedef std::chrono::steady_clock::time_point Tick;
+
+    inline Tick tick() {
+        return std::chrono::steady_clock::now();
+    }
+
+    // One kernel launch of a seam. Most stages are one launch per seam, the tiled DP is many.
+    struct Launch {
+        cl::Event event;
+        int seam;
+
+        Launch(const cl::Event &e, int s) : event(e), seam(s) {}
+    };
+
+    struct Stats {
+        std::string inputImage;
+        int origWidth, height;
+        std::vector<double> iterNs;
+        cl_ulong stageNs[NUM_STAGES];
+        bool profiling;             // false if the queue has no profiling, stageNs stays 0
+
+        Stats(const std::string &image, int width, int h, bool profiled = true)
+            : inputImage(image), origWidth(width), height(h), profiling(profiled) {
+            std::fill(stageNs, stageNs + NUM_STAGES, 0);
+            // Only the file name goes in the csv
+            size_t slash = inputImage.rfind('/');
+            if (slash != std::string::npos) {
+                inputImage = inputImage.substr(slash + 1);
+            }
+        }
+
+        /**
+         * Charges a finished kernel to a stage. The queue must have profiling enabled.
+         */
+        void kernel(Stage stage, const cl::Event &event) {
+            cl_ulong start, end;
+            event.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
+            event.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
+            stageNs[stage] += (end - start);
+        }
+
+        /**
+         * Records a batch of seams enqueued back to back with no host sync between them.
+         * launches[stage] are that stage's kernels, in order, each carve ending its seam. The
+         * batch wall time is split over its seams in proportion to their device time (end of the
+         * seam's carve to end of the previous one's), so the seam times still add up to the wall
+         * clock, launch overhead and readbacks included.
+         */
+        void batch(Tick start, const std::vector<Launch> launches[NUM_STAGES]) {
+            const double wallNs = std::chrono::duration<double, std::nano>(tick() - start).count();
+            const size_t n = launches[CARVE].size();
+            if (n == 0) {
+                return;
+            }
+            if (!profiling) {
+                iterNs.insert(iterNs.end(), n, wallNs / n);
+                return;
+            }
+            for (int s = 0; s < NUM_STAGES; ++s) {
+                for (size_t i = 0; i < launches[s].size(); ++i) {
+                    kernel((Stage) s, launches[s][i].event);
+                }
+            }
+
+            std::vector<double> span(n);
+            double deviceNs = 0.0;
+            // The first seam starts with the earliest launch of any stage: a stage can sit a
+            // batch out (the fused carve leaves no energy launches after the first seam)
+            cl_ulong prevEnd = 0;
+            bool started = false;
+            for (int s = 0; s < NUM_STAGES; ++s) {
+                if (!launches[s].empty()) {
+                    cl_ulong first;
+                    launches[s][0].event.getProfilingInfo(CL_PROFILING_COMMAND_START, &first);
+                    if (!started || first < prevEnd) {
+                        prevEnd = first;
+                        started = true;
+                    }
+                }
+            }
+            for (size_t i = 0; i < n; ++i) {
+                cl_ulong end;
+                launches[CARVE][i].event.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
+                span[i] = (double) (end - prevEnd);
+                deviceNs += span[i];
+                prevEnd = end;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                iterNs.push_back((deviceNs > 0) ? wallNs * span[i] / deviceNs : wallNs / n);
+            }
+        }
+
+        double totalNs() const {
+            double total = 0;
+            for (size_t i = 0; i < iterNs.size(); ++i) {
+                total += iterNs[i];
+            }
+            return total;
+        }
+
+        // Nearest rank percentile of the seam times, in ms
+        double percentileMs(double pct) const {
+            if (iterNs.empty()) {
+                return 0.0;
+            }
+            std::vector<double> sorted(iterNs);
+            std::sort(sorted.begin(), sorted.end());
+            int rank = (int) (pct / 100.0 * sorted.size() + 0.5);
+            rank = std::min(std::max(rank - 1, 0), (int) sorted.size() - 1);
+            return sorted[rank] * 1e-6;
+        }
+
+        /**
+         * Writes the stats as json, or as one andromeda.csv row (seamc columns left empty)
+         * followed by the per-kernel totals.
+         */
+        void write(FILE *out, bool asJSON) const {
+            const int n = (int) iterNs.size();
+            const double totalSec = totalNs() * 1e-9;
+            const double avgMs = (n > 0) ? (totalNs() * 1e-6 / n) : 0.0;
+
+            if (asJSON) {
+                fprintf(out, "{\n");
+                fprintf(out, "  \"input_image\": \"%s\",\n", inputImage.c_str());
+                fprintf(out, "  \"cols_removed\": %d,\n", n);
+                fprintf(out, "  \"orig_width\": %d,\n", origWidth);
+                fprintf(out, "  \"height\": %d,\n", height);
+                fprintf(out, "  \"seamcl_total_time_seconds\": %.6f,\n", totalSec);
+                fprintf(out, "  \"seamcl_avg_time_per_iteration_milliseconds\": %.6f,\n", avgMs);
+                fprintf(out, "  \"iter_p50_ms\": %.6f,\n", percentileMs(50.0));
+                fprintf(out, "  \"iter_p95_ms\": %.6f,\n", percentileMs(95.0));
+                fprintf(out, "  \"stages\": {\n");
+                for (int s = 0; s < NUM_STAGES; ++s) {
+                    fprintf(out, "    \"%s\": { \"total_ms\": %.6f, \"calls\": %d }%s\n",
+                            STAGE_NAMES[s], stageNs[s] * 1e-6, n, (s < NUM_STAGES - 1) ? "," : "");
+                }
+                fprintf(out, "  }\n}\n");
+            } else {
+                fprintf(out, "input_image, cols_removed, seamcl_total_time_seconds, "
+                        "seamcl_avg_time_per_iteration_milliseconds, seamc_total_time_seconds, "
+                        "seamc_total_time_milliseconds, seamc_avg_time_per_iteration_milliseconds,"
+                        "orig_width,actual_half_c,act_100_c,avg_ns_row_c");
+                for (int s = 0; s < NUM_STAGES; ++s) {
+                    fprintf(out, ",%s_ms", STAGE_NAMES[s]);
+                }
+                fprintf(out, ",iter_p50_ms,iter_p95_ms\n");
+
+                fprintf(out, "%s,%d,%.6f,%.6f,,,,%d,,,", inputImage.c_str(), n, totalSec, avgMs,
+                        origWidth);
+                for (int s = 0; s < NUM_STAGES; ++s) {
+                    fprintf(out, ",%.6f", stageNs[s] * 1e-6);
+                }
+                fprintf(out, ",%.6f,%.6f\n", percentileMs(50.0), percentileMs(95.0));
+            }
+        }
+
+        /**
+         * Writes to a file, or stdout if the name is empty.
+         */
+        void write(const std::string &fileName, bool asJSON) const {
+            FILE *out = fileName.empty() ? stdout : fopen(fileName.c_str(), "w");
+            if (!out) {
+                std::cerr << "Could not write stats to " << fileName << std::endl;
+                return;
+            }
+            write(out, asJSON);
+            if (out != stdout) {
+                fclose(out);
+            }
+        }
+    };
+
+} // namespace stats
+
+#endif
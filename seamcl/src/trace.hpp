@@ -0,0 +1,150 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+// C
+#include <cstdio>
+
+// STL
+#include <iostream>
+#include <string>
+#include <vector>
+
+// OpenCL
+#include <CL/cl.hpp>
+
+// SeamCL
+#include "stats.hpp"
+
+// Timeline of every kernel and the big host steps, written as Chrome trace event json (open it
+// in chrome://tracing or ui.perfetto.dev). Device timestamps are moved onto the host clock using
+// the first kernel: its QUEUED time is taken to be the moment the host enqueued it.
+namespace trace {
+
+    // Tracks (thread ids) in the viewer
+    enum Track { HOST = 1, COMPILER, DEVICE, QUEUE };
+
+    struct Span {
+        std::string name;
+        int track;
+        double startNs, endNs;
+        int seam;                   // -1 for host spans
+        double submitNs;            // queue track only, when the driver handed it to the device
+    };
+
+    struct Trace {
+        bool enabled;
+        stats::Tick origin;
+        std::vector<Span> spans;
+
+        // Maps device time onto host time, see anchor()
+        cl::Event anchorEvent;
+        double anchorNs;
+        bool anchored;
+        double deviceOffsetNs;
+        bool haveOffset;
+
+        Trace(bool on)
+            : enabled(on), origin(stats::tick()), anchorNs(0), anchored(false),
+              deviceOffsetNs(0), haveOffset(false) {}
+
+        double sinceOrigin(stats::Tick t) const {
+            return std::chrono::duration<double, std::nano>(t - origin).count();
+        }
+
+        /**
+         * Records a host step that ran from start to end.
+         */
+        void host(const std::string &name, stats::Tick start, stats::Tick end, Track track = HOST) {
+            if (!enabled) {
+                return;
+            }
+            Span s = { name, track, sinceOrigin(start), sinceOrigin(end), -1, -1 };
+            spans.push_back(s);
+        }
+
+        /**
+         * Remembers the first kernel and when the host enqueued it. Only the first call counts.
+         */
+        void anchor(const cl::Event &event, stats::Tick enqueued) {
+            if (!enabled || anchored) {
+                return;
+            }
+            anchorEvent = event;
+            anchorNs = sinceOrigin(enqueued);
+            anchored = true;
+        }
+
+        /**
+         * Records a finished batch of seams. Each kernel gets a span from START to END on the
+         * device track and one from QUEUED to START (with SUBMIT in its args) on the queue track,
+         * so gaps and host-side stalls both show up.
+         */
+        void kernels(const std::vector<stats::Launch> launches[stats::NUM_STAGES]) {
+            if (!enabled) {
+                return;
+            }
+            if (!haveOffset && anchored) {
+                cl_ulong queued;
+                anchorEvent.getProfilingInfo(CL_PROFILING_COMMAND_QUEUED, &queued);
+                deviceOffsetNs = anchorNs - (double) queued;
+                haveOffset = true;
+            }
+            for (int s = 0; s < stats::NUM_STAGES; ++s) {
+                for (size_t i = 0; i < launches[s].size(); ++i) {
+                    const stats::Launch &l = launches[s][i];
+                    cl_ulong queued, submit, start, end;
+                    l.event.getProfilingInfo(CL_PROFILING_COMMAND_QUEUED, &queued);
+                    l.event.getProfilingInfo(CL_PROFILING_COMMAND_SUBMIT, &submit);
+                    l.event.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
+                    l.event.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
+
+                    Span run = { stats::STAGE_NAMES[s], DEVICE, start + deviceOffsetNs,
+                                 end + deviceOffsetNs, l.seam, -1 };
+                    Span wait = { stats::STAGE_NAMES[s], QUEUE, queued + deviceOffsetNs,
+                                  start + deviceOffsetNs, l.seam, submit + deviceOffsetNs };
+                    spans.push_back(run);
+                    spans.push_back(wait);
+                }
+            }
+        }
+
+        /**
+         * Writes the trace, nothing if tracing is off.
+         */
+        void write(const std::string &fileName) const {
+            if (!enabled) {
+                return;
+            }
+            FILE *out = fopen(fileName.c_str(), "w");
+            if (!out) {
+                std::cerr << "Could not write trace to " << fileName << std::endl;
+                return;
+            }
+            static const char *TRACK_NAMES[] = { "", "host", "compiler", "device", "queued" };
+            fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+            for (int t = HOST; t <= QUEUE; ++t) {
+                fprintf(out, "%s{\"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"name\": \"thread_name\", "
+                        "\"args\": {\"name\": \"%s\"}}", (t > HOST) ? ",\n" : "", t, TRACK_NAMES[t]);
+            }
+            for (size_t i = 0; i < spans.size(); ++i) {
+                const Span &s = spans[i];
+                // Chrome trace times are microseconds
+                fprintf(out, ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"name\": \"%s\", "
+                        "\"ts\": %.3f, \"dur\": %.3f", s.track, s.name.c_str(), s.startNs * 1e-3,
+                        (s.endNs - s.startNs) * 1e-3);
+                if (s.submitNs >= 0) {
+                    fprintf(out, ", \"args\": {\"seam\": %d, \"submit_ts\": %.3f}", s.seam,
+                            s.submitNs * 1e-3);
+                } else if (s.seam >= 0) {
+                    fprintf(out, ", \"args\": {\"seam\": %d}", s.seam);
+                }
+                fprintf(out, "}");
+            }
+            fprintf(out, "\n]}\n");
+            fclose(out);
+        }
+    };
+
+} // namespace trace
+
+#endif
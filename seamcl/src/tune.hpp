@@ -0,0 +1,357 @@
+#ifndef TUNE_HPP
+#define TUNE_HPP
+
+// C
+#include <cmath>
+#include <cstdio>
+
+// STL
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// OpenCL
+#include <CL/cl.hpp>
+
+// SeamCL
+#include "kernel.hpp"
+#include "setup.hpp"
+#include "stats.hpp"
+
+// Work group size autotuner. --autotune times every legal local size of each live kernel on the
+// real image and stores the winners in a per-device profile, keyed by image size class; normal
+// runs load the profile and fall back to the kernel::localSizes defaults for anything missing.
+namespace tune {
+
+    int log2Ceil(int n) {
+        int l = 0;
+        while ((1 << l) < n) {
+            ++l;
+        }
+        return l;
+    }
+
+    /**
+     * Size class of an image: width and height rounded up to powers of two, e.g. "1024x512".
+     */
+    std::string sizeClass(int width, int height) {
+        std::ostringstream s;
+        s << (1 << log2Ceil(width)) << "x" << (1 << log2Ceil(height));
+        return s.str();
+    }
+
+    /**
+     * The profile file: --tune-profile if given, otherwise <device>.tune in the kernel cache
+     * directory. Empty if neither is set.
+     */
+    std::string profilePath(const std::string &override, const cl::Device &device) {
+        if (!override.empty()) {
+            return override;
+        }
+        if (setup::kernelCache.empty()) {
+            return std::string();
+        }
+        return setup::kernelCache + "/" + setup::fileSafe(device.getInfo<CL_DEVICE_NAME>()) + ".tune";
+    }
+
+    struct Entry {
+        int classW, classH;
+        int stage;
+        kernel::LocalSize size;
+    };
+
+    std::vector<Entry> read(const std::string &path) {
+        std::vector<Entry> entries;
+        std::ifstream file(path.c_str());
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::istringstream fields(line);
+            std::string cls, stage;
+            Entry e;
+            char x;
+            if (!(fields >> cls >> stage >> e.size.x >> e.size.y)) {
+                continue;
+            }
+            std::istringstream dims(cls);
+            if (!(dims >> e.classW >> x >> e.classH) || x != 'x') {
+                continue;
+            }
+            e.stage = -1;
+            for (int s = 0; s < stats::NUM_STAGES; ++s) {
+                if (stage == stats::STAGE_NAMES[s]) {
+                    e.stage = s;
+                }
+            }
+            if (e.stage >= 0 && e.size.x > 0 && e.size.y > 0) {
+                entries.push_back(e);
+            }
+        }
+        return entries;
+    }
+
+    /**
+     * Sets kernel::localSizes from the profile, taking for each kernel the entry whose size
+     * class is closest (in powers of two) to this image's. Returns false if there was nothing to
+     * load.
+     */
+    bool load(const std::string &path, const cl::Device &device, int width, int height) {
+        std::vector<Entry> entries = read(path);
+        const int w = 1 << log2Ceil(width), h = 1 << log2Ceil(height);
+        bool any = false;
+        for (int s = 0; s < stats::NUM_STAGES; ++s) {
+            int best = -1;
+            double bestDist = 0;
+            for (size_t i = 0; i < entries.size(); ++i) {
+                if (entries[i].stage != s) {
+                    continue;
+                }
+                double dist = fabs(log2((double) entries[i].classW / w)) +
+                              fabs(log2((double) entries[i].classH / h));
+                if (best < 0 || dist < bestDist) {
+                    best = (int) i;
+                    bestDist = dist;
+                }
+            }
+            if (best < 0) {
+                continue;
+            }
+            kernel::localSizes[s] = entries[best].size;
+            any = true;
+        }
+        kernel::fitLocalSizes(device);
+        return any;
+    }
+
+    /**
+     * Writes the current kernel::localSizes as this size class's entries, keeping the other
+     * classes already in the profile.
+     */
+    void save(const std::string &path, const cl::Device &device, int width, int height) {
+        if (path.empty()) {
+            std::cerr << "No kernel cache or --tune-profile, not saving the tuned sizes." << std::endl;
+            return;
+        }
+        const std::string cls = sizeClass(width, height);
+        std::vector<std::string> kept;
+        {
+            std::ifstream file(path.c_str());
+            std::string line;
+            while (std::getline(file, line)) {
+                if (!line.empty() && line[0] != '#' && line.compare(0, cls.size() + 1, cls + " ") != 0) {
+                    kept.push_back(line);
+                }
+            }
+        }
+        if (path == profilePath(std::string(), device)) {
+            setup::makeDirs(setup::kernelCache);
+        }
+        std::ofstream out(path.c_str());
+        if (!out) {
+            std::cerr << "Could not write tuning profile " << path << std::endl;
+            return;
+        }
+        out << "# seamcl work group sizes for " << device.getInfo<CL_DEVICE_NAME>()
+            << ", written by --autotune" << std::endl;
+        out << "# <size class> <kernel> <local x> <local y>" << std::endl;
+        for (size_t i = 0; i < kept.size(); ++i) {
+            out << kept[i] << std::endl;
+        }
+        for (int s = 0; s < stats::NUM_STAGES; ++s) {
+            if (s == stats::BACKTRACK) {
+                continue;
+            }
+            out << cls << " " << stats::STAGE_NAMES[s] << " " << kernel::localSizes[s].x << " "
+                << kernel::localSizes[s].y << std::endl;
+        }
+    }
+
+    /**
+     * The local sizes worth trying for a kernel: powers of two no bigger than the kernel allows
+     * (CL_KERNEL_WORK_GROUP_SIZE, CL_DEVICE_MAX_WORK_ITEM_SIZES) or than the image, with at least
+     * the preferred multiple of items so no SIMD lanes are left idle.
+     */
+    std::vector<kernel::LocalSize> candidates(stats::Stage stage, const cl::Device &device,
+                                              int width, int height) {
+        std::vector<kernel::LocalSize> found;
+        const cl::Kernel &k = *kernel::stageKernel(stage);
+        const size_t maxGroup = kernel::maxWorkGroup(stage, device);
+        const size_t multiple = std::min(maxGroup,
+            k.getWorkGroupInfo<CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(device));
+        const std::vector<size_t> maxItems = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+        const bool twoD = (stage == stats::ENERGY || stage == stats::MASK || stage == stats::CARVE);
+
+        const size_t maxX = std::min(maxItems[0], (size_t) 1 << log2Ceil(width));
+        const size_t maxY = twoD ? std::min(maxItems[1], (size_t) 1 << log2Ceil(height)) : 1;
+        for (size_t x = 1; x <= maxX; x *= 2) {
+            for (size_t y = 1; y <= maxY; y *= 2) {
+                if (x * y <= maxGroup && x * y >= multiple) {
+                    kernel::LocalSize size = { x, y };
+                    found.push_back(size);
+                }
+            }
+        }
+        return found;
+    }
+
+    // The buffers the seam loop uses, so each kernel can be timed on real data. output is only
+    // needed by the copying carves, parents and jumps only by the pointer jumping backtrack.
+    struct Buffers {
+        cl::Buffer *image, *output, *energyMatrix, *costMatrix, *parents, *jumps;
+        cl::Buffer *vertMinEnergy, *vertMinIdx, *vertSeamPath;
+    };
+
+    // Which kernels the seam loop runs for each stage, see the options of the same names
+    struct Pipeline {
+        std::string energy;     // incremental, fused or full
+        bool coneDP;
+        bool fusedMin;
+        bool inPlaceCarve;
+    };
+
+    // Whether a stage's kernel takes kernel::localSizes on every seam of the pipeline, rather
+    // than only on the first (the full gradient and the mask, unless --energy=full) or not at
+    // all (image_gradient_seam has no work group size, the fused min has no launch of its own)
+    bool tunable(stats::Stage stage, const Pipeline &p) {
+        switch (stage) {
+        case stats::ENERGY:
+        case stats::MASK: return p.energy == "full";
+        case stats::FINDMIN: return !p.fusedMin;
+        case stats::BACKTRACK: return false;
+        default: return true;
+        }
+    }
+
+    /**
+     * Enqueues one stage with the current kernel::localSizes, as the seam loop would after the
+     * first seam (from seam 0 for seam0), every launch goes in launches.
+     */
+    void launch(stats::Stage stage, const Pipeline &p, bool seam0, cl::Context &ctx,
+                cl::CommandQueue &queue, std::vector<cl::Event> &launches, Buffers &b,
+                int width, int height, int pitch) {
+        std::vector<cl::Event> deps;
+        cl::Event event;
+        cl::Buffer *minEnergy = p.fusedMin ? b.vertMinEnergy : NULL;
+        cl::Buffer *minIdx = p.fusedMin ? b.vertMinIdx : NULL;
+        switch (stage) {
+        case stats::ENERGY:
+            kernel::gradient(ctx, queue, event, deps, *b.image, *b.energyMatrix, height, width, pitch, 0);
+            break;
+        case stats::MASK:
+            kernel::maskUnreachable(ctx, queue, event, deps, *b.energyMatrix, width, height, pitch, 0);
+            break;
+        case stats::DP:
+            if (p.coneDP && !seam0) {
+                kernel::updateSeams(ctx, queue, event, deps, *b.energyMatrix, *b.costMatrix,
+                                    b.parents, *b.vertSeamPath, width, height, pitch, 1, false,
+                                    minEnergy, minIdx);
+                break;
+            }
+            kernel::computeSeams(ctx, queue, event, deps, *b.energyMatrix, *b.costMatrix, b.parents,
+                                 width, height, pitch, 0, &launches, false, minEnergy, minIdx);
+            return;
+        case stats::FINDMIN:
+            kernel::findMinSeamVert(ctx, queue, event, deps, *b.costMatrix, *b.vertMinEnergy,
+                                    *b.vertMinIdx, width, height, pitch, 0);
+            break;
+        case stats::BACKTRACK:
+            kernel::backtrack(ctx, queue, event, deps, *b.costMatrix, *b.vertSeamPath,
+                              *b.vertMinIdx, width, height, pitch, 0, b.parents, b.jumps,
+                              &launches);
+            return;
+        default:
+            if (p.energy == "fused") {
+                kernel::carveVertGradient(ctx, queue, event, deps, *b.image, *b.output,
+                                          *b.vertSeamPath, *b.energyMatrix, width, height, pitch, 1);
+            } else if (p.inPlaceCarve) {
+                kernel::Carried carried = { p.energy == "incremental" ? b.energyMatrix : NULL,
+                                            p.coneDP ? b.costMatrix : NULL,
+                                            p.coneDP ? b.parents : NULL };
+                kernel::carveVertInPlace(ctx, queue, event, deps, *b.image, *b.vertSeamPath,
+                                         width, height, pitch, 1, carried);
+            } else {
+                kernel::carveVert(ctx, queue, event, deps, *b.image, *b.output, *b.vertSeamPath,
+                                  width, height, pitch, 1);
+            }
+            break;
+        }
+        launches.push_back(event);
+    }
+
+    /**
+     * Finds the fastest local size of every kernel the pipeline launches per seam, for this
+     * image, and leaves it in kernel::localSizes; the others keep what they had. Runs a first
+     * seam, so the carried matrices and the seam are there, then the stages' kernels per
+     * candidate before the real carve starts; the seam loop recomputes everything from the
+     * image, so nothing it leaves in the buffers matters.
+     */
+    void run(cl::Context &ctx, const cl::Device &device, const Pipeline &pipeline,
+             Buffers &buffers, int width, int height, int pitch) {
+        cl::CommandQueue queue(ctx, device, CL_QUEUE_PROFILING_ENABLE);
+        const int RUNS = 4;
+
+        for (int s = 0; s < stats::NUM_STAGES; ++s) {
+            if (s != stats::MASK && s != stats::CARVE &&
+                (s != stats::FINDMIN || !pipeline.fusedMin)) {
+                std::vector<cl::Event> launches;
+                launch((stats::Stage) s, pipeline, true, ctx, queue, launches, buffers,
+                       width, height, pitch);
+            }
+        }
+        queue.finish();
+
+        for (int s = 0; s < stats::NUM_STAGES; ++s) {
+            const stats::Stage stage = (stats::Stage) s;
+            std::vector<cl::Event> launches;
+            if (stage == stats::BACKTRACK) {
+                // Not tunable, but the carve needs the seam of what the DP left
+                launch(stage, pipeline, false, ctx, queue, launches, buffers, width, height, pitch);
+                queue.finish();
+                continue;
+            }
+            if (!tunable(stage, pipeline)) {
+                continue;
+            }
+            std::vector<kernel::LocalSize> sizes = candidates(stage, device, width, height);
+            if (sizes.empty()) {
+                continue;
+            }
+            size_t best = 0;
+            double bestNs = -1;
+            for (size_t c = 0; c < sizes.size(); ++c) {
+                kernel::localSizes[s] = sizes[c];
+                double candidateNs = -1;
+                // The first run is a warm up
+                for (int r = 0; r < RUNS; ++r) {
+                    launches.clear();
+                    launch(stage, pipeline, false, ctx, queue, launches, buffers, width, height,
+                           pitch);
+                    queue.finish();
+                    // The tiled DP is many launches, the gaps between them count too
+                    cl_ulong start, end;
+                    launches.front().getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
+                    launches.back().getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
+                    const double runNs = (double) (end - start);
+                    if (r > 0 && (candidateNs < 0 || runNs < candidateNs)) {
+                        candidateNs = runNs;
+                    }
+                }
+                if (bestNs < 0 || candidateNs < bestNs) {
+                    bestNs = candidateNs;
+                    best = c;
+                }
+            }
+            kernel::localSizes[s] = sizes[best];
+            std::cout << "Tuned " << stats::STAGE_NAMES[s] << ":\t" << kernel::localSizes[s].x
+                      << " x " << kernel::localSizes[s].y << "\t" << bestNs * 1e-3 << " micros"
+                      << std::endl;
+        }
+    }
+
+} // namespace tune
+
+#endif
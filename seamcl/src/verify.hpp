@@ -2,6 +2,7 @@
 #define VERIFY_HPP
 
 // C
+#include <cfloat>
 #include <cmath>
 #include <sys/time.h>
 #include <ctime>
@@ -11,6 +12,7 @@
 #include <iostream>
 #include <algorithm>
 #include <limits>
+#include <vector>
 
 // OpencL
 #include <CL/cl.hpp>
@@ -57,60 +59,146 @@ namespace verify {
 
 
 
+    /**
+     * Recomputes the DP on the host and compares it with the device result. The recurrence
+     * matches hostSeam (nothing is read past the last live column), so a mismatch on the edge
+     * columns points at the kernel's clamping.
+     * @return Whether the device result matches, the first mismatch is reported on stderr.
+     */
     bool computeSeams(float* deviceResult,
                       float* originalEnergyMatrix,
                       int width,
                       int height,
                       int pitch,
                       int colsRemoved) {
-
-
-        std::cerr << "in verify::computeSeams" << std::endl;
-        float *hostResult = new float[pitch * height];
-        memcpy(hostResult, originalEnergyMatrix, pitch * height * sizeof(float));
+        std::vector<float> hostResult(originalEnergyMatrix, originalEnergyMatrix + pitch * height);
+        float *hostMatrix = &hostResult[0];
 
         const int imgEndIdx = width - colsRemoved;
 
         for (int y = 1; y < height; ++y) {
             for (int x = 0; x < imgEndIdx; ++x) {
-                rM(hostResult, x, y) = rM(originalEnergyMatrix, x, y) +
-                    std::min(rM(hostResult,x, y-1),
-                             std::min(rM(hostResult, std::max(x-1, 0), y-1),
-                                      rM(hostResult, std::min(x+1,imgEndIdx), y-1)));
+                float right = (x + 1 < imgEndIdx) ? rM(hostMatrix, x + 1, y - 1) : FLT_MAX;
+                rM(hostMatrix, x, y) = rM(originalEnergyMatrix, x, y) +
+                    min3(rM(hostMatrix, std::max(x - 1, 0), y - 1), rM(hostMatrix, x, y - 1), right);
             }
         }
 
-        std::cerr << "height\t" << height << std::endl;
-        std::cerr << "width\t" << width << std::endl;
-
-
-        //print original matrix
+        // Sums get large towards the bottom, so the tolerance is relative
+        const float epsilon = 0.00001f;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < imgEndIdx; ++x) {
+                float expected = rM(hostMatrix, x, y), actual = rM(deviceResult, x, y);
+                if (fabsf(expected - actual) > epsilon * std::max(1.0f, fabsf(expected))) {
+                    std::cerr << "computeSeams mismatch at (" << x << ", " << y << ") iteration "
+                              << colsRemoved << ": expected " << expected << ", got " << actual
+                              << std::endl;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
 
-        // std::cout << "ENERGYMATRIX: " << std::endl;
-        // printMatrix(originalEnergyMatrix, height, width, pitch);
+    // The seam tie rule, see precision.hpp (SEAM_STEP)
+    template<typename Cost>
+    inline int seamStep(Cost left, Cost center, Cost right) {
+        return (center <= left && center <= right) ? 0 : (left <= right) ? -1 : 1;
+    }
 
-        // std::cout << "DEVICERESULT: " << std::endl;
-        // printMatrix(deviceResult, height, width, pitch);
+    // hostSeam for one lum/cost type pair
+    template<typename Lum, typename Cost>
+    void hostSeamT(const unsigned char *img,
+                   int width,
+                   int height,
+                   int colsRemoved,
+                   std::vector<int> &path,
+                   Cost costMax) {
+        const int pitch = width;
+        const int imgEndIdx = width - colsRemoved;
+        const bool integer = std::numeric_limits<Lum>::is_integer;
+        std::vector<Lum> lum((size_t) width * height);
+        std::vector<Cost> cost((size_t) width * height);
+
+        // BGRA bytes
+        for (size_t i = 0; i < lum.size(); ++i) {
+            const unsigned char *p = img + 4 * i;
+            if (integer) {
+                lum[i] = (Lum) ((77 * p[2] + 150 * p[1] + 29 * p[0] + 128) >> 8);
+            } else {
+                lum[i] = (Lum) ((float)p[2] * 0.299f + (float)p[1] * 0.587f + (float)p[0] * 0.114f);
+            }
+        }
 
-        // std::cout << "HOSTRESULT: " << std::endl;
-        // printMatrix(hostResult, height, width, pitch);
+        // image_gradient and mask_unreachable
+        for (int y = 0; y < height; ++y) {
+            const int yb = std::max(y - 1, 0), ya = std::min(y + 1, height - 1);
+            for (int x = 0; x < width; ++x) {
+                if (x >= imgEndIdx) {
+                    rM(&cost[0], x, y) = costMax;
+                    continue;
+                }
+                const int xl = std::max(x - 1, 0), xr = std::min(x + 1, imgEndIdx - 1);
+                Lum gx = rM(&lum[0], xr, yb) - rM(&lum[0], xl, yb) + rM(&lum[0], xr, ya) -
+                    rM(&lum[0], xl, ya) + 2 * (rM(&lum[0], xr, y) - rM(&lum[0], xl, y));
+                Lum gy = rM(&lum[0], xl, ya) - rM(&lum[0], xl, yb) + rM(&lum[0], xr, ya) -
+                    rM(&lum[0], xr, yb) + 2 * (rM(&lum[0], x, ya) - rM(&lum[0], x, yb));
+                rM(&cost[0], x, y) = (Cost) ((gx < 0 ? -gx : gx) + (gy < 0 ? -gy : gy));
+            }
+        }
 
-        bool correct = true;
+        // computeSeams
+        for (int y = 1; y < height; ++y) {
+            for (int x = 0; x < imgEndIdx; ++x) {
+                Cost pathCost = min3(rM(&cost[0], std::max(x - 1, 0), y - 1), rM(&cost[0], x, y - 1),
+                                     rM(&cost[0], std::min(x + 1, imgEndIdx - 1), y - 1));
+                rM(&cost[0], x, y) += pathCost;
+            }
+        }
 
-        float epsilon = 0.00001f;
-        for (int x = 0; x < imgEndIdx; ++x) {
-            for (int y = 0; y < height; ++y) {
-                if (fabsf(rM(hostResult, x, y) - rM(deviceResult, x, y)) > epsilon) {
-                    std::cerr << "Mismatch at (" << x << ", " << y << ") " << std::endl;
-                    std::cerr << "Expected:\t" << rM(hostResult, x, y) << std::endl;
-                    std::cerr << "Actual:\t" << rM(deviceResult, x, y) << std::endl;
-                    correct = false;
-                }
+        // find_min_vert, leftmost on ties
+        path.resize(height);
+        int curIdx = 0;
+        for (int x = 1; x < imgEndIdx; ++x) {
+            if (rM(&cost[0], x, height - 1) < rM(&cost[0], curIdx, height - 1)) {
+                curIdx = x;
             }
         }
-        delete [] hostResult;
-        std::cout << "finished verifying computeSeams." << std::endl;
-        return correct;
+        path[height - 1] = curIdx;
+
+        // backtrack_vert
+        for (int y = height - 2; y >= 0; --y) {
+            Cost left = (curIdx < 1) ? costMax : rM(&cost[0], curIdx - 1, y);
+            Cost center = rM(&cost[0], curIdx, y);
+            Cost right = (curIdx + 1 >= imgEndIdx) ? costMax : rM(&cost[0], curIdx + 1, y);
+            curIdx += seamStep(left, center, right);
+            path[y] = curIdx;
+        }
+    }
+
+    /**
+     * Host reference for one iteration: Sobel energy, mask, DP and backtrack, following
+     * the kernels step for step (same stencil clamps, same tie rule). Used to check seams
+     * from a reduced precision energy matrix against the float path, or (integer) to check
+     * --precision=int seams for an exact match.
+     * @param img The current image, BGRA bytes with a row pitch of width.
+     * @param width The width of the image buffer.
+     * @param height The height of the image.
+     * @param colsRemoved Number of columns already carved.
+     * @param path Resized to height and filled with the seam, one column per row.
+     * @param integer Integer luminance and uint32 costs, as precision::INT.
+     */
+    void hostSeam(const unsigned char *img,
+                  int width,
+                  int height,
+                  int colsRemoved,
+                  std::vector<int> &path,
+                  bool integer = false) {
+        if (integer) {
+            hostSeamT<int, cl_uint>(img, width, height, colsRemoved, path, CL_UINT_MAX);
+        } else {
+            hostSeamT<float, float>(img, width, height, colsRemoved, path, FLT_MAX);
+        }
     }
 
 }
@@ -402,6 +402,63 @@ public:
 	}
 };
 
+///
+// Display the per-kernel limits seamcl's work group tuner works within:
+// CL_KERNEL_WORK_GROUP_SIZE and CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE
+// depend on the kernel as well as the device, so build a trivial one.
+//
+void DisplayKernelLimits(cl_device_id device)
+{
+	cl_int errNum;
+	const char * source =
+		"__kernel void probe(__global float *m) { m[get_global_id(0)] += 1.0f; }";
+
+	cl_context context = clCreateContext(NULL, 1, &device, NULL, NULL, &errNum);
+	if (errNum != CL_SUCCESS)
+	{
+		std::cerr << "Failed to create a context for the kernel limits." << std::endl;
+		return;
+	}
+
+	cl_program program = clCreateProgramWithSource(context, 1, &source, NULL, &errNum);
+	if (errNum == CL_SUCCESS)
+	{
+		errNum = clBuildProgram(program, 1, &device, NULL, NULL, NULL);
+	}
+	cl_kernel kernel = NULL;
+	if (errNum == CL_SUCCESS)
+	{
+		kernel = clCreateKernel(program, "probe", &errNum);
+	}
+
+	if (errNum != CL_SUCCESS)
+	{
+		std::cerr << "Failed to build the probe kernel." << std::endl;
+	}
+	else
+	{
+		std::size_t groupSize, multiple;
+		cl_ulong localMem;
+		clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+			sizeof(groupSize), &groupSize, NULL);
+		clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+			sizeof(multiple), &multiple, NULL);
+		clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_LOCAL_MEM_SIZE,
+			sizeof(localMem), &localMem, NULL);
+
+		std::cout << "\t\tCL_KERNEL_WORK_GROUP_SIZE (probe):\t" << groupSize << std::endl;
+		std::cout << "\t\tCL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE (probe):\t" << multiple << std::endl;
+		std::cout << "\t\tCL_KERNEL_LOCAL_MEM_SIZE (probe):\t" << localMem << std::endl;
+		clReleaseKernel(kernel);
+	}
+
+	if (program != NULL)
+	{
+		clReleaseProgram(program);
+	}
+	clReleaseContext(context);
+}
+
 ///
 //  Enumerate platforms and display information about them 
 //  and their associated devices.
@@ -796,6 +853,8 @@ void displayInfo(void)
 				CL_DEVICE_EXTENSIONS, 
 				"CL_DEVICE_EXTENSIONS");
 
+			DisplayKernelLimits(devices[j]);
+
 
 			std::cout << std::endl << std::endl;
 		}